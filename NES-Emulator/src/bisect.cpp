@@ -0,0 +1,237 @@
+//
+//  bisect.cpp
+//  NES-Emulator
+//
+
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <limits>
+#include <cstring>
+#include <cstdio>
+
+#include "bisect.hpp"
+#include "nes.hpp"
+
+
+bool BISECT::parse(std::string text, Config &config){
+    config = Config();
+    config.name = text;
+    std::istringstream words(text);
+    std::string word;
+    while(std::getline(words, word, ',')){
+        if(word == "video")
+            config.video = true;
+        else if(word == "novideo")
+            config.video = false;
+        else if(word == "scalar" || word == "sse2" || word == "avx2")
+            config.compositor = word;
+        else
+            return false;
+    }
+    return true;
+}
+
+
+BISECT::BISECT(const Config &a, const Config &b, uint64_t interval) : interval(interval){
+    sides[0].config = a;
+    sides[1].config = b;
+    divergence = std::numeric_limits<uint64_t>::max();
+}
+
+
+bool BISECT::load(std::string rom, std::string movie){
+    for(Side &side : sides){
+        side.nes = NES::headless(rom);
+        side.nes->movie = MOVIE::play(movie, side.nes);
+        if(side.nes->movie == NULL)
+            return false;
+        side.nes->ppu->set_video(side.config.video);
+        if(!side.config.compositor.empty() && !side.nes->ppu->get_compositor()->select(side.config.compositor.c_str())){
+            std::cout << "This cpu can not run the " << side.config.compositor << " compositor" << std::endl;
+            return false;
+        }
+        side.hashes.resize(side.nes->movie->get_frames() + 1);
+        side.state.resize(NES::state_size());
+        side.masked.resize(NES::state_size());
+    }
+    snapshots.resize(sides[0].nes->movie->get_frames() / interval + 1);
+    return true;
+}
+
+
+
+void BISECT::hash_frames(int side){
+    NES *nes = sides[side].nes;
+    hashed(side, nes->movie->get_frame());
+    while(nes->movie->is_playing() && sides[side].hashed <= divergence){
+        nes->clock();
+        if(nes->ppu->is_frame_start()){
+            nes->movie->frame_start(nes);
+            hashed(side, nes->movie->get_frame());
+        }
+    }
+}
+
+void BISECT::hashed(int side, uint64_t frame){
+    Side &self = sides[side];
+    Side &other = sides[1 - side];
+    self.nes->save_state(self.state.data(), self.state.size());
+    self.hashes[frame] = hash(self);
+    if(side == 0 && frame % interval == 0)
+        snapshots[frame / interval] = self.state;
+    if(frame == 0)
+        self.start = self.state;
+    self.hashed = frame + 1;
+
+    //the side which hashes a frame last compares it (both do if they hash it at the same time)
+    if(other.hashed > frame && other.hashes[frame] != self.hashes[frame]){
+        uint64_t first = divergence;
+        while(frame < first && !divergence.compare_exchange_weak(first, frame));
+    }
+}
+
+
+uint64_t BISECT::hash(Side &side){
+    side.masked = side.state;
+    for(const NES::StateField &field : NES::state_fields())
+        if(field.pipeline)
+            std::memset(side.masked.data() + field.offset, 0, field.size);
+    return STATEHASH::hash(side.masked.data(), side.masked.size());
+}
+
+
+void BISECT::run_to(int side, uint64_t frame){
+    NES *nes = sides[side].nes;
+    while(nes->movie->get_frame() < frame){
+        nes->clock();
+        if(nes->ppu->is_frame_start())
+            nes->movie->frame_start(nes);
+    }
+}
+
+
+
+bool BISECT::differ(){
+    for(const NES::StateField &field : NES::state_fields())
+        if(!field.pipeline && std::memcmp(sides[0].state.data() + field.offset, sides[1].state.data() + field.offset, field.size) != 0)
+            return true;
+    return false;
+}
+
+void BISECT::print_differences(){
+    const int MAX_LINES = 32;
+    int lines = 0;
+    std::printf("%s / %s:\n", sides[0].config.name.c_str(), sides[1].config.name.c_str());
+    for(const NES::StateField &field : NES::state_fields()){
+        const Byte *a = sides[0].state.data() + field.offset;
+        const Byte *b = sides[1].state.data() + field.offset;
+        if(field.pipeline || std::memcmp(a, b, field.size) == 0)
+            continue;
+
+        if(field.address < 0 && field.size <= 8){ //a register or a counter
+            uint64_t value_a = 0, value_b = 0;
+            std::memcpy(&value_a, a, field.size);
+            std::memcpy(&value_b, b, field.size);
+            if(lines++ < MAX_LINES)
+                std::printf("  %s: %llx / %llx\n", field.name, (unsigned long long) value_a, (unsigned long long) value_b);
+            continue;
+        }
+        for(size_t i = 0; i < field.size; i++){ //memory: each byte
+            if(a[i] == b[i] || lines++ >= MAX_LINES)
+                continue;
+            if(field.address >= 0)
+                std::printf("  %s $%04zx: %02x / %02x\n", field.name, field.address + i, a[i], b[i]);
+            else
+                std::printf("  %s[%zu]: %02x / %02x\n", field.name, i, a[i], b[i]);
+        }
+    }
+    if(lines > MAX_LINES)
+        std::printf("  and %d more\n", lines - MAX_LINES);
+}
+
+
+
+int BISECT::run(){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::thread first(&BISECT::hash_frames, this, 0);
+    std::thread second(&BISECT::hash_frames, this, 1);
+    first.join();
+    second.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t frame = divergence;
+    if(frame == std::numeric_limits<uint64_t>::max()){
+        std::printf("%llu frames compared in %.2f s, %s and %s give the same states\n",
+                    (unsigned long long) sides[0].nes->movie->get_frames(), seconds,
+                    sides[0].config.name.c_str(), sides[1].config.name.c_str());
+        return 0;
+    }
+    std::printf("The states differ at the start of frame %llu (found in %.2f s)\n", (unsigned long long) frame, seconds);
+    if(frame == 0){ //the start states differ: one side may have gone on before the other saw it
+        for(Side &side : sides)
+            side.state = side.start;
+        print_differences();
+        return 1;
+    }
+
+    //both sides are the same at the start of the frame before: from the last snapshot before it
+    uint64_t snapshot = (frame - 1) / interval * interval;
+    for(Side &side : sides){
+        side.nes->load_state(snapshots[snapshot / interval].data(), snapshots[snapshot / interval].size());
+        side.nes->movie->set_frame(snapshot);
+    }
+    first = std::thread(&BISECT::run_to, this, 0, frame - 1);
+    second = std::thread(&BISECT::run_to, this, 1, frame - 1);
+    first.join();
+    second.join();
+    for(int side = 0; side < 2; side++){
+        sides[side].nes->save_state(sides[side].state.data(), sides[side].state.size());
+        if(hash(sides[side]) != sides[side].hashes[frame - 1]){
+            std::printf("%s does not give the same state at frame %llu when it plays the movie again: it is not deterministic\n",
+                        sides[side].config.name.c_str(), (unsigned long long) frame - 1);
+            return 1;
+        }
+    }
+
+    //then a dot at a time
+    NES *a = sides[0].nes;
+    NES *b = sides[1].nes;
+    bool known = false;   //an instruction started since the start of the frame
+    Address pc = 0x0000;
+    Byte opcode = 0x00;
+    uint64_t dots = 0;    //since it started
+    while(a->movie->get_frame() < frame){
+        bool starts = a->instruction_starts();
+        if(starts)
+            pc = a->cpu->get_register_PC();
+        a->clock();
+        b->clock();
+        if(starts){
+            opcode = a->cpu->get_opcode();
+            known = true;
+            dots = 0;
+        }
+        dots++;
+        for(Side &side : sides){
+            if(side.nes->ppu->is_frame_start())
+                side.nes->movie->frame_start(side.nes);
+            side.nes->save_state(side.state.data(), side.state.size());
+        }
+
+        if(differ()){
+            std::printf("First difference in frame %llu, scanline %d, dot %d (cpu cycle %d)\n",
+                        (unsigned long long) frame - 1, a->ppu->get_scanline(), a->ppu->get_cycle(), a->cpu->get_cycles());
+            if(known)
+                std::printf("Instruction: $%04x, opcode $%02x, %s\n", pc, opcode,
+                            dots == 1 ? "executed at this dot" : (std::to_string(dots - 1) + " dots before").c_str());
+            print_differences();
+            return 1;
+        }
+    }
+    //the hashes of the frame are compared on the same fields as the dots: only a collision of the hashes brings us here
+    std::printf("No difference outside the render pipeline of the ppu during frame %llu, %s and %s give the same states\n",
+                (unsigned long long) frame - 1, sides[0].config.name.c_str(), sides[1].config.name.c_str());
+    return 0;
+}
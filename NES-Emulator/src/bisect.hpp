@@ -0,0 +1,69 @@
+//
+//  bisect.hpp
+//  NES-Emulator
+//
+
+#ifndef bisect_hpp
+#define bisect_hpp
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+typedef uint8_t Byte;
+
+class NES;
+
+
+//Finds where two configurations of the emulator stop doing the same thing with the same movie.
+//
+//A configuration is a list of words separated by commas:
+//  video or novideo: without video the PPU only runs its render pipeline on the lines where sprite 0 can hit
+//  scalar, sse2 or avx2: version of the compositor (see compositor.hpp), the best one by default
+//
+//Each side plays the movie on its own thread and hashes its state at the start of each frame (see STATEHASH), but for
+//the render pipeline of the PPU, both stop once a frame has different hashes. Then both sides load the last snapshot before that frame
+//(one is kept every `interval` frames), run to the last frame where they were the same and go on together
+//a dot at a time. The states are compared after each dot, but for the render pipeline of the PPU which depends on
+//the video during a frame (see NES::StateField): the first dot where they differ is printed with the instruction
+//being executed and every field which differs.
+class BISECT{
+public:
+    struct Config{
+        std::string name;
+        bool video = false;
+        std::string compositor; //empty: the best one
+    };
+    static bool parse(std::string text, Config &); //false if it is not a configuration
+
+    BISECT(const Config &a, const Config &b, uint64_t interval = 60);
+    bool load(std::string rom, std::string movie); //on both sides, false if the movie can not be played
+    int run(); //prints where the sides diverge, returns 0 if they do not, 1 if they do
+
+private:
+    struct Side{
+        Config config;
+        NES *nes = NULL;
+        std::vector<uint64_t> hashes;     //of the state at the start of each frame of the movie
+        std::atomic<uint64_t> hashed{0};  //number of frames hashed
+        std::vector<Byte> state;
+        std::vector<Byte> start;          //the state at the start of the movie
+        std::vector<Byte> masked;         //the state without the render pipeline, which is hashed
+    };
+
+    Side sides[2];
+    uint64_t interval;
+    std::vector<std::vector<Byte>> snapshots; //of the first side, every `interval` frames
+    std::atomic<uint64_t> divergence;         //first frame whose hashes differ
+
+    void hash_frames(int side);
+    void hashed(int side, uint64_t frame);
+    uint64_t hash(Side &); //of its state, but for the render pipeline
+    void run_to(int side, uint64_t frame);
+    bool differ(); //between the states of the sides, but for the render pipeline
+    void print_differences();
+};
+
+#endif /* bisect_hpp */
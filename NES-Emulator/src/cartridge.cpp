@@ -91,9 +91,14 @@ void CARTRIDGE::load(std::string link){
     }
     
     
+    hash = 0xcbf29ce484222325;
+    for(int pos = 0x8000; pos <= 0xFFFF; pos++)
+        hash = (hash ^ this->prgROM->at(pos)) * 0x100000001b3;
+    
     for(int pos = 0x0000; pos <= 0x1FFF; pos++){ //load chrom
         ROMfile.read(&buffer,1);
         this->nes->ppu->write(pos, (Byte) buffer);
+        hash = (hash ^ (Byte) buffer) * 0x100000001b3;
     }
     ROMfile.close();
 }
@@ -11,6 +11,7 @@
 #include <array>
 #include <string>
 #include <fstream>
+#include <cstdint>
 
 typedef uint8_t Byte;
 typedef uint16_t Address;
@@ -31,6 +32,7 @@ public:
     
     //addresses 0x0000 ~ 0x7FFF are useless but it makes it easier to address
     std::array<Byte, 0xFFFF + 1> *prgROM = new std::array<Byte, 0xFFFF + 1>; //prg ROM + prg RAM
+    uint64_t hash = 0; //FNV-1a of the prg and chr ROM, identifies the game (save states)
     
     void load(std::string);
     Byte readROM(Address);
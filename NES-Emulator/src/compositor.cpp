@@ -0,0 +1,194 @@
+//
+//  compositor.cpp
+//  NES-Emulator
+//
+
+#include <cstring>
+
+#include "compositor.hpp"
+
+//every x86-64 cpu has SSE2. AVX2 is only used if the cpu running the emulator has it
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define COMPOSITOR_AVX2
+#endif
+
+
+COMPOSITOR::COMPOSITOR(){
+    kernel = &COMPOSITOR::scalar;
+    name = "scalar";
+#if defined(__SSE2__)
+    kernel = &COMPOSITOR::sse2;
+    name = "sse2";
+#endif
+#if defined(COMPOSITOR_AVX2)
+    if(__builtin_cpu_supports("avx2")){
+        kernel = &COMPOSITOR::avx2;
+        name = "avx2";
+    }
+#endif
+}
+
+bool COMPOSITOR::select(const char *wanted){
+    if(std::strcmp(wanted, "scalar") == 0){
+        kernel = &COMPOSITOR::scalar;
+        name = "scalar";
+        return true;
+    }
+#if defined(__SSE2__)
+    if(std::strcmp(wanted, "sse2") == 0){
+        kernel = &COMPOSITOR::sse2;
+        name = "sse2";
+        return true;
+    }
+#endif
+#if defined(COMPOSITOR_AVX2)
+    if(std::strcmp(wanted, "avx2") == 0 && __builtin_cpu_supports("avx2")){
+        kernel = &COMPOSITOR::avx2;
+        name = "avx2";
+        return true;
+    }
+#endif
+    return false;
+}
+
+
+int COMPOSITOR::scalar(const uint8_t *background, const uint8_t *sprites, uint8_t *addresses, int first, int last, uint8_t mask){
+    int hit = -1;
+    for(int x = first; x < last; x++){
+        //the 8 leftmost pixels are hidden if bit 1 (background) or 2 (sprites) of PPUMASK is cleared
+        bool background_visible = (mask & 0x08) && (x >= 8 || (mask & 0x02));
+        bool sprite_visible = (mask & 0x10) && (x >= 8 || (mask & 0x04));
+        bool background_opaque = background_visible && (background[x] & 0x03);
+        bool sprite_opaque = sprite_visible && (sprites[x] & 0x03);
+
+        if(sprite_opaque && (!background_opaque || !(sprites[x] & 0x10)))
+            addresses[x] = 0x10 | (sprites[x] & 0x0F);
+        else if(background_opaque)
+            addresses[x] = background[x] & 0x0F;
+        else
+            addresses[x] = 0x00; //backdrop color
+
+        //sprite 0 hit does not depend on the priority and never happens on the last pixel
+        if(hit < 0 && sprite_opaque && background_opaque && (sprites[x] & 0x20) && x != 255)
+            hit = x;
+    }
+    return hit;
+}
+
+
+#if defined(__SSE2__)
+int COMPOSITOR::sse2(const uint8_t *background, const uint8_t *sprites, uint8_t *addresses, int first, int last, uint8_t mask){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8((char) 0xFF);
+    const __m128i three = _mm_set1_epi8(0x03);
+    const __m128i behind = _mm_set1_epi8(0x10);
+    const __m128i sprite_0 = _mm_set1_epi8(0x20);
+    const __m128i seven = _mm_set1_epi8(0x07);
+    const __m128i low = _mm_set1_epi8(0x0F);
+    const __m128i last_pixel = _mm_set1_epi8((char) 0xFF);
+    const __m128i lanes = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    //all ones when the layer is enabled, and when it is clipped in the left column
+    const __m128i background_enabled = (mask & 0x08) ? ones : zero;
+    const __m128i sprites_enabled = (mask & 0x10) ? ones : zero;
+    const __m128i background_clipped = (mask & 0x02) ? zero : ones;
+    const __m128i sprites_clipped = (mask & 0x04) ? zero : ones;
+
+    int hit = -1;
+    int x = first;
+    for(; x + 16 <= last; x += 16){
+        __m128i position = _mm_add_epi8(_mm_set1_epi8((char) x), lanes);
+        __m128i left = _mm_cmpeq_epi8(_mm_min_epu8(position, seven), position); //x <= 7
+        __m128i bg = _mm_loadu_si128((const __m128i *) (background + x));
+        __m128i sp = _mm_loadu_si128((const __m128i *) (sprites + x));
+
+        __m128i background_opaque = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_and_si128(bg, three), zero),
+                                                     _mm_andnot_si128(_mm_and_si128(left, background_clipped), background_enabled));
+        __m128i sprite_opaque = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_and_si128(sp, three), zero),
+                                                 _mm_andnot_si128(_mm_and_si128(left, sprites_clipped), sprites_enabled));
+        __m128i in_front = _mm_cmpeq_epi8(_mm_and_si128(sp, behind), zero);
+        __m128i sprite_drawn = _mm_and_si128(sprite_opaque, _mm_or_si128(in_front, _mm_xor_si128(background_opaque, ones)));
+
+        //sprite_drawn ? 0x10 | sprite : (background_opaque ? background : 0)
+        __m128i result = _mm_and_si128(background_opaque, _mm_and_si128(bg, low));
+        result = _mm_or_si128(_mm_and_si128(sprite_drawn, _mm_or_si128(behind, _mm_and_si128(sp, low))), _mm_andnot_si128(sprite_drawn, result));
+        _mm_storeu_si128((__m128i *) (addresses + x), result);
+
+        if(hit < 0){
+            __m128i hits = _mm_and_si128(_mm_and_si128(sprite_opaque, background_opaque), _mm_cmpeq_epi8(_mm_and_si128(sp, sprite_0), sprite_0));
+            hits = _mm_andnot_si128(_mm_cmpeq_epi8(position, last_pixel), hits);
+            int bits = _mm_movemask_epi8(hits);
+            if(bits)
+                hit = x + __builtin_ctz(bits);
+        }
+    }
+
+    int tail = scalar(background, sprites, addresses, x, last, mask);
+    return hit >= 0 ? hit : tail;
+}
+#else
+int COMPOSITOR::sse2(const uint8_t *background, const uint8_t *sprites, uint8_t *addresses, int first, int last, uint8_t mask){
+    return scalar(background, sprites, addresses, first, last, mask);
+}
+#endif
+
+
+#if defined(COMPOSITOR_AVX2)
+__attribute__((target("avx2")))
+int COMPOSITOR::avx2(const uint8_t *background, const uint8_t *sprites, uint8_t *addresses, int first, int last, uint8_t mask){
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi8((char) 0xFF);
+    const __m256i three = _mm256_set1_epi8(0x03);
+    const __m256i behind = _mm256_set1_epi8(0x10);
+    const __m256i sprite_0 = _mm256_set1_epi8(0x20);
+    const __m256i seven = _mm256_set1_epi8(0x07);
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    const __m256i last_pixel = _mm256_set1_epi8((char) 0xFF);
+    const __m256i lanes = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                           16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+
+    const __m256i background_enabled = (mask & 0x08) ? ones : zero;
+    const __m256i sprites_enabled = (mask & 0x10) ? ones : zero;
+    const __m256i background_clipped = (mask & 0x02) ? zero : ones;
+    const __m256i sprites_clipped = (mask & 0x04) ? zero : ones;
+
+    int hit = -1;
+    int x = first;
+    for(; x + 32 <= last; x += 32){
+        __m256i position = _mm256_add_epi8(_mm256_set1_epi8((char) x), lanes);
+        __m256i left = _mm256_cmpeq_epi8(_mm256_min_epu8(position, seven), position);
+        __m256i bg = _mm256_loadu_si256((const __m256i *) (background + x));
+        __m256i sp = _mm256_loadu_si256((const __m256i *) (sprites + x));
+
+        __m256i background_opaque = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_and_si256(bg, three), zero),
+                                                        _mm256_andnot_si256(_mm256_and_si256(left, background_clipped), background_enabled));
+        __m256i sprite_opaque = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_and_si256(sp, three), zero),
+                                                    _mm256_andnot_si256(_mm256_and_si256(left, sprites_clipped), sprites_enabled));
+        __m256i in_front = _mm256_cmpeq_epi8(_mm256_and_si256(sp, behind), zero);
+        __m256i sprite_drawn = _mm256_and_si256(sprite_opaque, _mm256_or_si256(in_front, _mm256_xor_si256(background_opaque, ones)));
+
+        __m256i result = _mm256_and_si256(background_opaque, _mm256_and_si256(bg, low));
+        result = _mm256_blendv_epi8(result, _mm256_or_si256(behind, _mm256_and_si256(sp, low)), sprite_drawn);
+        _mm256_storeu_si256((__m256i *) (addresses + x), result);
+
+        if(hit < 0){
+            __m256i hits = _mm256_and_si256(_mm256_and_si256(sprite_opaque, background_opaque), _mm256_cmpeq_epi8(_mm256_and_si256(sp, sprite_0), sprite_0));
+            hits = _mm256_andnot_si256(_mm256_cmpeq_epi8(position, last_pixel), hits);
+            unsigned int bits = (unsigned int) _mm256_movemask_epi8(hits);
+            if(bits)
+                hit = x + __builtin_ctz(bits);
+        }
+    }
+
+    int tail = sse2(background, sprites, addresses, x, last, mask);
+    return hit >= 0 ? hit : tail;
+}
+#else
+int COMPOSITOR::avx2(const uint8_t *background, const uint8_t *sprites, uint8_t *addresses, int first, int last, uint8_t mask){
+    return sse2(background, sprites, addresses, first, last, mask);
+}
+#endif
@@ -0,0 +1,50 @@
+//
+//  compositor.hpp
+//  NES-Emulator
+//
+
+#ifndef compositor_hpp
+#define compositor_hpp
+
+#include <cstdint>
+
+
+//Decides for a run of pixels whether the background or the sprite is drawn.
+//https://wiki.nesdev.org/w/index.php?title=PPU_rendering#Preface
+//https://wiki.nesdev.org/w/index.php?title=PPU_sprite_priority
+//
+//The PPU stores the pixels of a scanline as they are generated and the compositor handles
+//16 (SSE2) or 32 (AVX2) of them at a time. The best version the cpu supports is chosen at runtime.
+//
+//background pixels:        sprite pixels:
+//  3210                      543210
+//  ||||                      ||||||
+//  ||++- pixel value         ||||++- pixel value (0 = transparent)
+//  ++--- palette             ||++--- palette (4 to 7)
+//                            |+----- priority (0: in front of background; 1: behind background)
+//                            +------ this pixel belongs to sprite 0
+class COMPOSITOR{
+public:
+    //pixel x of the line is background[x] and sprites[x], the palette RAM address of the result is written in addresses[x]
+    //returns the first pixel where sprite 0 hits the background, -1 if it does not
+    typedef int (*Kernel)(const uint8_t *background, const uint8_t *sprites, uint8_t *addresses, int first, int last, uint8_t mask);
+
+    COMPOSITOR();
+
+    //mask is PPUMASK: it enables the background and the sprites and clips them in the 8 leftmost pixels
+    int run(const uint8_t *background, const uint8_t *sprites, uint8_t *addresses, int first, int last, uint8_t mask){
+        return kernel(background, sprites, addresses, first, last, mask);
+    }
+    const char *get_name(){ return name; }
+    bool select(const char *name); //scalar, sse2 or avx2, false if the cpu does not support it
+
+    static int scalar(const uint8_t *background, const uint8_t *sprites, uint8_t *addresses, int first, int last, uint8_t mask);
+    static int sse2(const uint8_t *background, const uint8_t *sprites, uint8_t *addresses, int first, int last, uint8_t mask);
+    static int avx2(const uint8_t *background, const uint8_t *sprites, uint8_t *addresses, int first, int last, uint8_t mask);
+
+private:
+    Kernel kernel;
+    const char *name;
+};
+
+#endif /* compositor_hpp */
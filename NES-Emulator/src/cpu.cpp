@@ -43,6 +43,11 @@ void CPU::clock(){
         this->rem_cycles--;
         return;
     }
+    if(this->jammed) //nothing is fetched until a reset
+        return;
+    
+    if(this->coverage != NULL)
+        this->coverage[this->registers.r_PC] = 1;
     
     //fetch opcode
     //the pc register is incremented to be prepared for the next read.
@@ -50,6 +55,13 @@ void CPU::clock(){
     
     instruction instr = (*this->instructions)[opcode]; //get the instruction
     
+    //the cpu stops on the opcodes which are not emulated, like on the JAM opcodes: the pc stays on it
+    if(instr.function == NULL || instr.addressing_mode == NULL){
+        this->registers.r_PC--;
+        this->jammed = true;
+        return;
+    }
+    
     this->rem_cycles = instr.cycles - 1; //-1 because this cycle is already the first cycle
     
     bool addr = (this->*instr.addressing_mode)();
@@ -229,7 +241,7 @@ Interruptions
  Two interrupts (/IRQ and /NMI) and two instructions (PHP and BRK) push the flags to the stack. In the byte pushed, bit 5 is always set to 1, and bit 4 is 1 if from an instruction (PHP or BRK) or 0 if from an interrupt line being pulled low (/IRQ or /NMI). This is the only time and place where the B flag actually exists: not in the status register itself, but in bit 4 of the copy that is written to the stack.
 */
 void CPU::IRQ(){
-    if(!this->getflag(flags.I)){ //if interupts are allowed
+    if(!this->getflag(flags.I) && !this->jammed){ //if interupts are allowed
         //0x0100 to offset
         this->nes->write(0x0100 + this->registers.r_SP--, (this->registers.r_PC) >> 8); //high
         this->nes->write(0x0100 + this->registers.r_SP--, (this->registers.r_PC) & 0x00FF); //low
@@ -243,6 +255,8 @@ void CPU::IRQ(){
     }
 }
 void CPU::NMI(){ //NMI cannot be ignored even if the flag I is set
+    if(this->jammed) //but a jammed cpu ignores it
+        return;
     this->rem_cycles = 6;
     
     //0x0100 to offset in the stack
@@ -276,6 +290,7 @@ bool CPU::BRK(){ //return type is bool because BRK is also an instruction. I put
 void CPU::reset(){
     this->rem_cycles = 6;
     
+    this->jammed = false;
     this->opcode = 0x00;
     this->registers.r_SP -= 3;
     this->registers.nv_bdizc |= 0x20;
@@ -283,6 +298,37 @@ void CPU::reset(){
     this->registers.r_PC |= (this->nes->read(0xFFFD) << 8);
 }
 
+void CPU::save_state(State &state){
+    state.r_A = this->registers.r_A;
+    state.r_iX = this->registers.r_iX;
+    state.r_iY = this->registers.r_iY;
+    state.r_SP = this->registers.r_SP;
+    state.r_PC = this->registers.r_PC;
+    state.nv_bdizc = this->registers.nv_bdizc;
+    state.opcode = this->opcode;
+    state.jammed = this->jammed;
+    state.data_to_read = this->data_to_read;
+    state.additionnal_cycles = this->additionnal_cycles;
+    state.rem_cycles = this->rem_cycles;
+    state.cycles = this->cycles;
+}
+
+void CPU::load_state(const State &state){
+    this->registers.r_A = state.r_A;
+    this->registers.r_iX = state.r_iX;
+    this->registers.r_iY = state.r_iY;
+    this->registers.r_SP = state.r_SP;
+    this->registers.r_PC = state.r_PC;
+    this->registers.nv_bdizc = state.nv_bdizc;
+    this->opcode = state.opcode;
+    this->jammed = state.jammed != 0;
+    this->data_to_read = state.data_to_read;
+    this->additionnal_cycles = state.additionnal_cycles;
+    this->rem_cycles = state.rem_cycles;
+    this->cycles = state.cycles;
+}
+
+
 CPU::CPU(NES *nes){
     this->nes = nes;
     
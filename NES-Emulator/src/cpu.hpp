@@ -59,8 +59,18 @@ public:
     void clock(); //main function of the cpu
     
     /* other */
-    Byte get_register_PC(){ return this->registers.r_PC; }
+    Address get_register_PC(){ return this->registers.r_PC; }
+    Byte get_opcode(){ return this->opcode; }
     int get_rem_cycles(){ return this->rem_cycles; }
+    int get_cycles(){ return this->cycles; }
+    bool is_jammed(){ return this->jammed; } //on an opcode which is not emulated, until a reset
+    
+    Byte *coverage = NULL; //if set, coverage[address] is set to 1 for each opcode executed at this address (see FUZZER)
+    
+    //save states (see NES::save_state)
+    struct State;
+    void save_state(State &);
+    void load_state(const State &);
 private:
     /*
      Registers
@@ -227,6 +237,7 @@ private:
     */
     NES *nes; //the CPU need to access other parts of the NES such as memory
     Byte opcode = 0x00; //the current opcode is stored for debugging purposses
+    bool jammed = false; //stopped on an opcode which is not emulated: no fetch and no interrupt until a reset
     int rem_cycles = 0; //remaining cycle until we fetch the next instruction
     int cycles = 1; //initialized at 1 because clock() is called for the first time when the cpu has already finished it's reset
     Address data_to_read = 0x0000; //used to store the data fetched until its use
@@ -235,6 +246,24 @@ private:
 };
 
 
+//everything that changes while the cpu runs
+//the registers are fields of their own: a copy of their struct would also copy its padding, which is not the same from one run to the other
+struct CPU::State{
+    Byte r_A;
+    Byte r_iX;
+    Byte r_iY;
+    Byte r_SP;
+    Address r_PC;
+    Byte nv_bdizc;
+    Byte opcode;
+    Byte jammed;
+    Address data_to_read;
+    int32_t additionnal_cycles;
+    int32_t rem_cycles;
+    int32_t cycles;
+};
+
+
 
 #endif /* cpu_hpp */
 
@@ -0,0 +1,95 @@
+//
+//  deferred.cpp
+//  NES-Emulator
+//
+
+#include "deferred.hpp"
+
+
+DEFERRED::DEFERRED(NES *nes, PPU *source, PRESENTER *presenter){
+    this->renderer = new PPU(nes, presenter);
+    this->renderer->copy_memory(*source); //the cartridge has already loaded the pattern tables
+    this->thread = std::thread(&DEFERRED::loop, this);
+}
+
+DEFERRED::~DEFERRED(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_one();
+    thread.join();
+    delete renderer;
+}
+
+
+
+std::vector<PPU_ACCESS> *DEFERRED::submit(std::vector<PPU_ACCESS> *log, uint64_t end){
+    std::vector<PPU_ACCESS> *next;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]{ return (int) this->jobs.size() < QUEUE_SIZE; });
+        jobs.push_back({log, end});
+        if(unused.empty())
+            next = new std::vector<PPU_ACCESS>;
+        else{
+            next = unused.back();
+            unused.pop_back();
+        }
+    }
+    wake.notify_one();
+    next->clear();
+    return next;
+}
+
+void DEFERRED::loop(){
+    while(1){
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]{ return this->stop || !this->jobs.empty(); });
+            if(stop)
+                return;
+            job = jobs.front();
+        }
+
+        replay(job);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.pop_front();
+            unused.push_back(job.log);
+        }
+        done.notify_one();
+    }
+}
+
+//each access is done after the clock of the dot it happened at, like in NES::clock
+void DEFERRED::replay(const Job &job){
+    for(size_t i = 0; i < job.log->size(); i++){
+        const PPU_ACCESS &access = (*job.log)[i];
+        while(renderer->get_dots() < access.dot)
+            renderer->clock();
+
+        switch (access.kind) {
+            case PPU_ACCESS::WRITE:
+                renderer->write_register(access.address, access.value);
+                break;
+
+            case PPU_ACCESS::READ:
+                renderer->read_register(access.address);
+                break;
+
+            case PPU_ACCESS::OAM_DMA:
+                renderer->setOAM_with_addr(access.value, access.address);
+                break;
+
+            case PPU_ACCESS::DMA_PAGE:
+                renderer->setOAMDMA(access.value);
+                break;
+        }
+    }
+
+    while(renderer->get_dots() < job.end) //the renderer publishes the frame during its last dot
+        renderer->clock();
+}
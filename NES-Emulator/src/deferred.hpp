@@ -0,0 +1,55 @@
+//
+//  deferred.hpp
+//  NES-Emulator
+//
+
+#ifndef deferred_hpp
+#define deferred_hpp
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "ppu.hpp"
+
+
+//Deferred rendering: the pixels of a frame are produced on an other thread while the cpu emulates the next one.
+//
+//The PPU of the emulation only keeps its timing (vblank, NMI, status flags, sprite 0 hit) and records
+//every access of the cpu that changes its state with the dot at which it happened.
+//The renderer is a second PPU which starts from the same state and replays these accesses at the
+//same dots, so it goes through exactly the same states and renders exactly the same frames.
+class DEFERRED{
+private:
+    PPU *renderer;
+
+    struct Job{
+        std::vector<PPU_ACCESS> *log;
+        uint64_t end; //dot at which the frame ends
+    };
+    static const int QUEUE_SIZE = 2;
+    std::deque<Job> jobs;
+    std::vector<std::vector<PPU_ACCESS> *> unused; //recycled logs
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;  //a job was submitted
+    std::condition_variable done;  //a job was finished
+    bool stop = false;
+
+    void loop();
+    void replay(const Job &);
+
+public:
+    //must be called before the emulation starts
+    DEFERRED(NES *, PPU *source, PRESENTER *);
+    ~DEFERRED();
+
+    //called by the emulation at the end of each frame, returns an empty log for the next frame
+    //it only blocks if the renderer is more than QUEUE_SIZE frames late (no access can be dropped)
+    std::vector<PPU_ACCESS> *submit(std::vector<PPU_ACCESS> *log, uint64_t end);
+};
+
+#endif /* deferred_hpp */
@@ -0,0 +1,386 @@
+//
+//  filter.cpp
+//  NES-Emulator
+//
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include "filter.hpp"
+
+//every x86-64 cpu has SSE2. Other cpus use the plain versions of the kernels
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+FILTER::FILTER(Scaler scaler, int factor, bool aspect, int threads){
+    this->scaler = scaler;
+    this->aspect = aspect;
+    if(scaler == SCALE2X)
+        this->factor = 2;
+    else if(scaler == SCALE3X)
+        this->factor = 3;
+    else
+        this->factor = factor < 1 ? 1 : factor;
+
+    this->scaled_width = 256 * this->factor;
+    this->output_height = 240 * this->factor;
+    //https://wiki.nesdev.org/w/index.php?title=Overscan explains why the pixels are 8/7 wider than high
+    this->output_width = aspect ? (int) std::lround(scaled_width * 8. / 7.) : scaled_width;
+    if(scaler == NTSC_COMPOSITE){ //the decoder already outputs the right aspect ratio
+        this->factor = 1;
+        this->aspect = aspect = false;
+        this->ntsc = new NTSC;
+        this->output_width = NTSC::WIDTH;
+        this->output_height = 240;
+    }
+
+    padded.resize(258 * 242);
+    if(aspect)
+        scaled.resize(scaled_width * output_height);
+    output.resize(output_width * output_height);
+    ready_output.resize(output_width * output_height);
+
+    for(int i = 0; i < QUEUE_SIZE; i++)
+        unused.push_back(new Slot);
+
+    if(aspect){
+        //each output pixel is a linear interpolation of the two closest source pixels
+        resample_index.resize(output_width);
+        resample_weight.resize(output_width);
+        for(int x = 0; x < output_width; x++){
+            //the first and last pixels are the closest source pixels: the weight stays in 0 ~ 256
+            double source = std::min(std::max((x + 0.5) * scaled_width / output_width - 0.5, 0.0), scaled_width - 1.0);
+            int index = std::min((int) source, scaled_width - 2);
+            resample_index[x] = index;
+            resample_weight[x] = (uint16_t) std::min(std::max(std::lround((source - index) * 256), 0L), 256L);
+        }
+    }
+
+    this->workers = new WORKERS(threads < 1 ? 1 : threads);
+    this->stage = std::thread(&FILTER::loop, this);
+}
+
+FILTER::~FILTER(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_one();
+    stage.join();
+    delete workers;
+    delete ntsc;
+    delete current;
+    for(size_t i = 0; i < queue.size(); i++)
+        delete queue[i];
+    for(size_t i = 0; i < unused.size(); i++)
+        delete unused[i];
+}
+
+void FILTER::set_sink(std::string link){
+    sink.open(link, std::ios::binary | std::ios::trunc);
+    if(sink.fail()){
+        std::cout << "Cannot open the filter output file";
+        std::exit(0);
+    }
+}
+
+
+
+void FILTER::submit(const Frame &frame, const std::array<uint32_t, 512> &colors, int frame_number){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot *slot;
+        if(unused.empty()){ //the queue is full, the oldest frame is dropped
+            slot = queue.front();
+            queue.erase(queue.begin());
+        }
+        else{
+            slot = unused.back();
+            unused.pop_back();
+        }
+        slot->frame = frame;
+        slot->colors = colors;
+        slot->frame_number = frame_number;
+        queue.push_back(slot);
+    }
+    wake.notify_one();
+}
+
+bool FILTER::fetch(std::vector<uint32_t> &frame){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!ready)
+        return false;
+    frame.swap(ready_output);
+    ready = false;
+    return true;
+}
+
+
+
+void FILTER::loop(){
+    while(1){
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]{ return this->stop || !this->queue.empty(); });
+            if(stop)
+                return;
+            unused.push_back(current);
+            current = queue.front();
+            queue.erase(queue.begin());
+        }
+
+        if(scaler == NTSC_COMPOSITE){
+            workers->run([this](int strip, int strips){
+                ntsc->render(current->frame, current->frame_number,
+                             WORKERS::first_line(strip, strips, 240), WORKERS::last_line(strip, strips, 240), output.data());
+            });
+        }
+        else{
+            //the scalers read the lines above and below so the whole frame must be converted first
+            workers->run([this](int strip, int strips){
+                convert(WORKERS::first_line(strip, strips, 240), WORKERS::last_line(strip, strips, 240));
+            });
+            workers->run([this](int strip, int strips){
+                int first = WORKERS::first_line(strip, strips, 240);
+                int last = WORKERS::last_line(strip, strips, 240);
+                scale(first, last);
+                if(aspect)
+                    resample(first * factor, last * factor);
+            });
+        }
+
+        if(sink.is_open())
+            sink.write((const char *) output.data(), output.size() * sizeof(uint32_t));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        output.swap(ready_output);
+        output.resize(output_width * output_height); //the buffer we get back may come from fetch()
+        ready = true;
+    }
+}
+
+
+//the converted frame has a one pixel border which repeats the edges
+void FILTER::convert(int first, int last){
+    const uint32_t *colors = current->colors.data();
+    const Pixel *frame = current->frame.data();
+    for(int y = first; y < last; y++){
+        uint32_t *line = &padded[(y + 1) * 258 + 1];
+        for(int x = 0; x < 256; x++)
+            line[x] = colors[frame[y * 256 + x] & 0x01FF];
+        line[-1] = line[0];
+        line[256] = line[255];
+    }
+    if(first == 0)
+        std::memcpy(&padded[0], &padded[258], 258 * sizeof(uint32_t));
+    if(last == 240)
+        std::memcpy(&padded[241 * 258], &padded[240 * 258], 258 * sizeof(uint32_t));
+}
+
+void FILTER::scale(int first, int last){
+    uint32_t *destination = aspect ? scaled.data() : output.data();
+    for(int y = first; y < last; y++){
+        uint32_t *line = destination + y * factor * scaled_width;
+        switch (scaler) {
+            case SCALE2X:
+                scale2x_line(y, line, line + scaled_width);
+                break;
+
+            case SCALE3X:
+                scale3x_line(y, line, line + scaled_width, line + 2 * scaled_width);
+                break;
+
+            default:
+                nearest_line(&padded[(y + 1) * 258 + 1], line);
+                for(int i = 1; i < factor; i++)
+                    std::memcpy(line + i * scaled_width, line, scaled_width * sizeof(uint32_t));
+                break;
+        }
+    }
+}
+
+void FILTER::resample(int first, int last){
+    for(int y = first; y < last; y++)
+        resample_line(&scaled[y * scaled_width], &output[y * output_width]);
+}
+
+
+
+void FILTER::nearest_line(const uint32_t *in, uint32_t *out){
+    int x = 0;
+#if defined(__SSE2__)
+    if(factor == 2){
+        for(; x < 256; x += 4){
+            __m128i v = _mm_loadu_si128((const __m128i *) (in + x));
+            _mm_storeu_si128((__m128i *) (out + 2 * x), _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128((__m128i *) (out + 2 * x + 4), _mm_unpackhi_epi32(v, v));
+        }
+    }
+    else if(factor == 3){
+        for(; x < 256; x += 4){
+            __m128i v = _mm_loadu_si128((const __m128i *) (in + x));
+            _mm_storeu_si128((__m128i *) (out + 3 * x), _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+            _mm_storeu_si128((__m128i *) (out + 3 * x + 4), _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+            _mm_storeu_si128((__m128i *) (out + 3 * x + 8), _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+        }
+    }
+    else if(factor == 4){
+        for(; x < 256; x += 4){
+            __m128i v = _mm_loadu_si128((const __m128i *) (in + x));
+            _mm_storeu_si128((__m128i *) (out + 4 * x), _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 0, 0, 0)));
+            _mm_storeu_si128((__m128i *) (out + 4 * x + 4), _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 1, 1, 1)));
+            _mm_storeu_si128((__m128i *) (out + 4 * x + 8), _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 2, 2)));
+            _mm_storeu_si128((__m128i *) (out + 4 * x + 12), _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)));
+        }
+    }
+#endif
+    for(; x < 256; x++)
+        for(int i = 0; i < factor; i++)
+            out[x * factor + i] = in[x];
+}
+
+
+//https://www.scale2x.it/algorithm
+//  A B C
+//  D E F   each pixel E is replaced by 2x2 (or 3x3) pixels
+//  G H I
+#if defined(__SSE2__)
+static inline __m128i blend(__m128i mask, __m128i a, __m128i b){ //mask ? a : b
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+#endif
+
+void FILTER::scale2x_line(int y, uint32_t *top, uint32_t *bottom){
+    const uint32_t *above = &padded[y * 258 + 1];
+    const uint32_t *line = &padded[(y + 1) * 258 + 1];
+    const uint32_t *below = &padded[(y + 2) * 258 + 1];
+
+    int x = 0;
+#if defined(__SSE2__)
+    for(; x < 256; x += 4){
+        __m128i B = _mm_loadu_si128((const __m128i *) (above + x));
+        __m128i D = _mm_loadu_si128((const __m128i *) (line + x - 1));
+        __m128i E = _mm_loadu_si128((const __m128i *) (line + x));
+        __m128i F = _mm_loadu_si128((const __m128i *) (line + x + 1));
+        __m128i H = _mm_loadu_si128((const __m128i *) (below + x));
+
+        //nothing changes if B == H or D == F
+        __m128i same = _mm_or_si128(_mm_cmpeq_epi32(B, H), _mm_cmpeq_epi32(D, F));
+        __m128i E0 = blend(_mm_andnot_si128(same, _mm_cmpeq_epi32(D, B)), D, E);
+        __m128i E1 = blend(_mm_andnot_si128(same, _mm_cmpeq_epi32(B, F)), F, E);
+        __m128i E2 = blend(_mm_andnot_si128(same, _mm_cmpeq_epi32(D, H)), D, E);
+        __m128i E3 = blend(_mm_andnot_si128(same, _mm_cmpeq_epi32(H, F)), F, E);
+
+        _mm_storeu_si128((__m128i *) (top + 2 * x), _mm_unpacklo_epi32(E0, E1));
+        _mm_storeu_si128((__m128i *) (top + 2 * x + 4), _mm_unpackhi_epi32(E0, E1));
+        _mm_storeu_si128((__m128i *) (bottom + 2 * x), _mm_unpacklo_epi32(E2, E3));
+        _mm_storeu_si128((__m128i *) (bottom + 2 * x + 4), _mm_unpackhi_epi32(E2, E3));
+    }
+#endif
+    for(; x < 256; x++){
+        uint32_t B = above[x], D = line[x - 1], E = line[x], F = line[x + 1], H = below[x];
+        bool changes = (B != H) && (D != F);
+        top[2 * x]        = (changes && D == B) ? D : E;
+        top[2 * x + 1]    = (changes && B == F) ? F : E;
+        bottom[2 * x]     = (changes && D == H) ? D : E;
+        bottom[2 * x + 1] = (changes && H == F) ? F : E;
+    }
+}
+
+void FILTER::scale3x_line(int y, uint32_t *top, uint32_t *middle, uint32_t *bottom){
+    const uint32_t *above = &padded[y * 258 + 1];
+    const uint32_t *line = &padded[(y + 1) * 258 + 1];
+    const uint32_t *below = &padded[(y + 2) * 258 + 1];
+
+    int x = 0;
+#if defined(__SSE2__)
+    uint32_t e[9][4];
+    for(; x < 256; x += 4){
+        __m128i A = _mm_loadu_si128((const __m128i *) (above + x - 1));
+        __m128i B = _mm_loadu_si128((const __m128i *) (above + x));
+        __m128i C = _mm_loadu_si128((const __m128i *) (above + x + 1));
+        __m128i D = _mm_loadu_si128((const __m128i *) (line + x - 1));
+        __m128i E = _mm_loadu_si128((const __m128i *) (line + x));
+        __m128i F = _mm_loadu_si128((const __m128i *) (line + x + 1));
+        __m128i G = _mm_loadu_si128((const __m128i *) (below + x - 1));
+        __m128i H = _mm_loadu_si128((const __m128i *) (below + x));
+        __m128i I = _mm_loadu_si128((const __m128i *) (below + x + 1));
+
+        __m128i same = _mm_or_si128(_mm_cmpeq_epi32(B, H), _mm_cmpeq_epi32(D, F));
+        __m128i DB = _mm_andnot_si128(same, _mm_cmpeq_epi32(D, B));
+        __m128i BF = _mm_andnot_si128(same, _mm_cmpeq_epi32(B, F));
+        __m128i DH = _mm_andnot_si128(same, _mm_cmpeq_epi32(D, H));
+        __m128i HF = _mm_andnot_si128(same, _mm_cmpeq_epi32(H, F));
+        __m128i EA = _mm_cmpeq_epi32(E, A);
+        __m128i EC = _mm_cmpeq_epi32(E, C);
+        __m128i EG = _mm_cmpeq_epi32(E, G);
+        __m128i EI = _mm_cmpeq_epi32(E, I);
+
+        _mm_storeu_si128((__m128i *) e[0], blend(DB, D, E));
+        _mm_storeu_si128((__m128i *) e[1], blend(_mm_or_si128(_mm_andnot_si128(EC, DB), _mm_andnot_si128(EA, BF)), B, E));
+        _mm_storeu_si128((__m128i *) e[2], blend(BF, F, E));
+        _mm_storeu_si128((__m128i *) e[3], blend(_mm_or_si128(_mm_andnot_si128(EG, DB), _mm_andnot_si128(EA, DH)), D, E));
+        _mm_storeu_si128((__m128i *) e[4], E);
+        _mm_storeu_si128((__m128i *) e[5], blend(_mm_or_si128(_mm_andnot_si128(EI, BF), _mm_andnot_si128(EC, HF)), F, E));
+        _mm_storeu_si128((__m128i *) e[6], blend(DH, D, E));
+        _mm_storeu_si128((__m128i *) e[7], blend(_mm_or_si128(_mm_andnot_si128(EI, DH), _mm_andnot_si128(EG, HF)), H, E));
+        _mm_storeu_si128((__m128i *) e[8], blend(HF, F, E));
+
+        for(int i = 0; i < 4; i++){
+            int o = 3 * (x + i);
+            top[o] = e[0][i];    top[o + 1] = e[1][i];    top[o + 2] = e[2][i];
+            middle[o] = e[3][i]; middle[o + 1] = e[4][i]; middle[o + 2] = e[5][i];
+            bottom[o] = e[6][i]; bottom[o + 1] = e[7][i]; bottom[o + 2] = e[8][i];
+        }
+    }
+#endif
+    for(; x < 256; x++){
+        uint32_t A = above[x - 1], B = above[x], C = above[x + 1];
+        uint32_t D = line[x - 1],  E = line[x],  F = line[x + 1];
+        uint32_t G = below[x - 1], H = below[x], I = below[x + 1];
+        bool changes = (B != H) && (D != F);
+        bool DB = changes && D == B, BF = changes && B == F, DH = changes && D == H, HF = changes && H == F;
+        int o = 3 * x;
+        top[o]        = DB ? D : E;
+        top[o + 1]    = ((DB && E != C) || (BF && E != A)) ? B : E;
+        top[o + 2]    = BF ? F : E;
+        middle[o]     = ((DB && E != G) || (DH && E != A)) ? D : E;
+        middle[o + 1] = E;
+        middle[o + 2] = ((BF && E != I) || (HF && E != C)) ? F : E;
+        bottom[o]     = DH ? D : E;
+        bottom[o + 1] = ((DH && E != I) || (HF && E != G)) ? H : E;
+        bottom[o + 2] = HF ? F : E;
+    }
+}
+
+
+void FILTER::resample_line(const uint32_t *in, uint32_t *out){
+    const int *index = resample_index.data();
+    const uint16_t *weight = resample_weight.data();
+
+    int x = 0;
+#if defined(__SSE2__)
+    //two pixels at a time: each channel is widened to 16 bits, a * (256 - w) + b * w fits in 16 bits
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(256);
+    for(; x + 2 <= output_width; x += 2){
+        __m128i a = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, in[index[x + 1]], in[index[x]]), zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, in[index[x + 1] + 1], in[index[x] + 1]), zero);
+        __m128i w = _mm_set_epi16(weight[x + 1], weight[x + 1], weight[x + 1], weight[x + 1], weight[x], weight[x], weight[x], weight[x]);
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(full, w)), _mm_mullo_epi16(b, w));
+        _mm_storel_epi64((__m128i *) (out + x), _mm_packus_epi16(_mm_srli_epi16(sum, 8), zero));
+    }
+#endif
+    for(; x < output_width; x++){
+        uint32_t a = in[index[x]], b = in[index[x] + 1], w = weight[x];
+        uint32_t pixel = 0;
+        for(int shift = 0; shift < 32; shift += 8)
+            pixel |= ((((a >> shift) & 0xFF) * (256 - w) + ((b >> shift) & 0xFF) * w) >> 8) << shift;
+        out[x] = pixel;
+    }
+}
@@ -0,0 +1,98 @@
+//
+//  filter.hpp
+//  NES-Emulator
+//
+
+#ifndef filter_hpp
+#define filter_hpp
+
+#include <array>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "screen.hpp"
+#include "workers.hpp"
+#include "ntsc.hpp"
+
+
+//CPU side post-processing of the frames.
+//It runs on its own thread (and splits each frame in horizontal strips between WORKERS) so
+//that the emulation never waits for it: frames wait in a small queue and when it is full the
+//oldest one is dropped rather than slowing down the emulation.
+//
+//the pipeline is:  palette indexes -> ARGB -> scaler -> 8:7 resampler (optional)
+//             or:  palette indexes -> NTSC signal -> decoded ARGB (602*240)
+class FILTER{
+public:
+    enum Scaler { NEAREST, SCALE2X, SCALE3X, NTSC_COMPOSITE };
+
+    FILTER(Scaler scaler, int factor, bool aspect, int threads); //factor is only used by NEAREST, aspect is not used by NTSC_COMPOSITE
+    ~FILTER();
+
+    int get_width(){ return output_width; }
+    int get_height(){ return output_height; }
+
+    //frames are also written to this file as raw 32 bits ARGB pixels, one frame after the other
+    void set_sink(std::string link);
+
+    //the image changes even if the frame does not (dot crawl), every frame must be submitted
+    bool is_animated(){ return scaler == NTSC_COMPOSITE; }
+
+    //both are called from the thread that owns the screen
+    void submit(const Frame &, const std::array<uint32_t, 512> &colors, int frame_number); //never blocks
+    bool fetch(std::vector<uint32_t> &); //swap the newest filtered frame with the given buffer if there is one
+
+private:
+    Scaler scaler;
+    int factor;
+    bool aspect;
+    int scaled_width, output_width, output_height;
+
+    WORKERS *workers;
+    std::thread stage;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stop = false;
+
+    //input queue, the slots are recycled
+    struct Slot{
+        Frame frame;
+        std::array<uint32_t, 512> colors;
+        int frame_number;
+    };
+    static const int QUEUE_SIZE = 3;
+    std::vector<Slot *> queue;   //oldest first
+    std::vector<Slot *> unused;
+
+    //working buffers (only touched by the stage and its workers)
+    Slot *current = new Slot;
+    NTSC *ntsc = NULL;
+    std::vector<uint32_t> padded; //ARGB frame with a one pixel border (scale2x and scale3x read the neighbours)
+    std::vector<uint32_t> scaled; //only used when the aspect ratio is corrected
+    std::vector<uint32_t> output;
+
+    //output mailbox
+    std::vector<uint32_t> ready_output;
+    bool ready = false;
+
+    //8:7 resampler tables: each output pixel blends two source pixels
+    std::vector<int> resample_index;
+    std::vector<uint16_t> resample_weight; //weight of the second pixel (0 ~ 256)
+
+    std::ofstream sink;
+
+    void loop();
+    void convert(int first, int last);          //lines of the frame
+    void scale(int first, int last);            //lines of the frame
+    void resample(int first, int last);         //lines of the scaled frame
+    void nearest_line(const uint32_t *in, uint32_t *out);
+    void scale2x_line(int y, uint32_t *top, uint32_t *bottom);
+    void scale3x_line(int y, uint32_t *top, uint32_t *middle, uint32_t *bottom);
+    void resample_line(const uint32_t *in, uint32_t *out);
+};
+
+#endif /* filter_hpp */
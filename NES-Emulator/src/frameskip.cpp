@@ -0,0 +1,42 @@
+//
+//  frameskip.cpp
+//  NES-Emulator
+//
+
+#include "frameskip.hpp"
+
+
+FRAMESKIP::FRAMESKIP(int skip, int out_of){
+    this->out_of = out_of > 0 ? out_of : 1;
+    this->skip = skip < 0 ? 0 : (skip >= this->out_of ? this->out_of - 1 : skip); //at least one frame is rendered
+    this->automatic = false;
+}
+
+FRAMESKIP *FRAMESKIP::automatic_skip(){
+    FRAMESKIP *frameskip = new FRAMESKIP(0, 1);
+    frameskip->automatic = true;
+    return frameskip;
+}
+
+
+
+bool FRAMESKIP::next(bool late, bool fast_forward){
+    if(automatic){
+        //skip one of every `skip + 1` frames, the last one is rendered
+        if(late){
+            on_time = 0;
+            if(skip < MAX_SKIP)
+                skip++;
+        }
+        else if(++on_time >= RECOVERY && skip > 0){
+            on_time = 0;
+            skip--;
+        }
+        out_of = skip + 1;
+    }
+
+    int cycle = fast_forward ? FAST_FORWARD : out_of;
+    int skipped = fast_forward ? FAST_FORWARD - 1 : skip;
+    frame = (frame + 1) % cycle;
+    return frame >= skipped;
+}
@@ -0,0 +1,38 @@
+//
+//  frameskip.hpp
+//  NES-Emulator
+//
+
+#ifndef frameskip_hpp
+#define frameskip_hpp
+
+
+//Decides which frames are rendered.
+//A skipped frame is emulated without video (see PPU::set_video): vblank, NMI, sprite 0 hit and every
+//register behave exactly the same, only the pixels are not generated and the frame is not shown.
+//
+//  fixed:      skips `skip` frames out of `out_of`
+//  automatic:  skips more frames while the emulation is late on the pacer and fewer once it keeps up
+//  fast forward (while tab is held): the pacer does not wait and only one frame out of FAST_FORWARD is rendered,
+//                even without --frameskip (the emulator then uses FRAMESKIP(0, 1))
+class FRAMESKIP{
+private:
+    static const int MAX_SKIP = 9;       //the automatic mode always renders at least one frame out of 10
+    static const int RECOVERY = 60;      //frames on time before the automatic mode skips one frame less
+    static const int FAST_FORWARD = 8;
+
+    int skip;
+    int out_of;
+    bool automatic;
+    int frame = 0;     //position in the current cycle of out_of frames
+    int on_time = 0;   //frames on time in a row (automatic)
+
+public:
+    FRAMESKIP(int skip, int out_of); //skip = 0 renders every frame
+    static FRAMESKIP *automatic_skip();
+
+    //a new frame starts, returns true if it must be rendered
+    bool next(bool late, bool fast_forward);
+};
+
+#endif /* frameskip_hpp */
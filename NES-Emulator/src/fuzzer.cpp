@@ -0,0 +1,289 @@
+//
+//  fuzzer.cpp
+//  NES-Emulator
+//
+
+#include <iostream>
+#include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+
+#include "fuzzer.hpp"
+#include "nes.hpp"
+
+
+static bool parse_address(std::string text, Address &address){
+    if(text.size() < 2 || text[0] != '$')
+        return false;
+    char *end;
+    unsigned long value = std::strtoul(text.c_str() + 1, &end, 16);
+    if(*end != '\0' || value > 0x1FFF) //the RAM and its mirrors
+        return false;
+    address = (Address) (value & 0x07FF);
+    return true;
+}
+
+bool FUZZER::parse_regions(std::string text, std::vector<Region> &regions){
+    regions.clear();
+    std::istringstream values(text);
+    std::string value;
+    while(std::getline(values, value, ',')){
+        size_t dash = value.find('-');
+        Region region;
+        if(!parse_address(value.substr(0, dash), region.first))
+            return false;
+        region.last = region.first;
+        if(dash != std::string::npos && !parse_address(value.substr(dash + 1), region.last))
+            return false;
+        if(region.last < region.first)
+            return false;
+        regions.push_back(region);
+    }
+    return !regions.empty();
+}
+
+
+
+FUZZER::FUZZER(std::string rom, const std::vector<Byte> &start, const std::vector<Region> &ram, int threads)
+: rom(rom), start(start), ram(ram), workers(threads < 1 ? 1 : threads){
+    instances.resize(workers.size());
+    for(int i = 0; i < workers.size(); i++){
+        Worker &worker = instances[i];
+        worker.nes = NES::headless(rom);
+        worker.random.seed(i + 1);
+        worker.frame_coverage.assign(0x10000, 0);
+        worker.nes->cpu->coverage = worker.frame_coverage.data();
+    }
+}
+
+void FUZZER::add_seed(const std::vector<Byte> &input){
+    corpus.push_back(input);
+}
+
+
+
+void FUZZER::play(Worker &worker, const std::vector<Byte> &input){
+    Result &result = worker.result;
+    NES *nes = worker.nes;
+    result.crash = NONE;
+    result.coverage.assign(0x10000, 0);
+    result.features.clear();
+    std::fill(worker.frame_coverage.begin(), worker.frame_coverage.end(), 0); //MOVIE::record_input also executes opcodes
+
+    nes->load_state(start.data(), start.size());
+    int stuck = 0; //frames
+    for(int frame = 0; frame < (int) input.size(); frame++){
+        nes->input->hold(input[frame]);
+        nes->run_frame();
+
+        //the addresses executed during the frame
+        Address nmi = (Address) (nes->read(0xFFFA) | nes->read(0xFFFB) << 8); //the handler
+        bool nmi_taken = worker.frame_coverage[nmi] != 0;
+        int executed = 0;
+        Address lowest = 0x0000, highest = 0x0000;
+        for(uint32_t address = 0x10000; address-- > 0;)
+            if(worker.frame_coverage[address]){
+                worker.frame_coverage[address] = 0;
+                result.coverage[address] = 1;
+                if(executed++ == 0)
+                    highest = (Address) address;
+                lowest = (Address) address;
+            }
+        for(size_t region = 0; region < ram.size(); region++){
+            uint64_t hash = STATEHASH::hash(nes->ram->data() + ram[region].first, ram[region].last - ram[region].first + 1);
+            result.features.push_back((uint32_t) (region << 16 | (hash & 0xFFFF)));
+        }
+
+        if(nes->cpu->is_jammed()){
+            result.crash = JAM;
+            result.pc = nes->cpu->get_register_PC();
+            result.frame = frame;
+            break;
+        }
+        stuck = executed != 0 && !nmi_taken && highest - lowest < STUCK_RANGE ? stuck + 1 : 0;
+        if(stuck >= STUCK_FRAMES){
+            result.crash = STUCK;
+            result.pc = lowest;
+            result.frame = frame;
+            break;
+        }
+    }
+    std::sort(result.features.begin(), result.features.end());
+    result.features.erase(std::unique(result.features.begin(), result.features.end()), result.features.end());
+}
+
+
+void FUZZER::mutate(Worker &worker, std::vector<Byte> &input){
+    std::mt19937_64 &random = worker.random;
+    int mutations = 1 + random() % 4;
+    for(int i = 0; i < mutations; i++){
+        size_t length = std::min(input.size(), (size_t) 1 << (random() % 7)); //1 to 64 frames
+        size_t first = random() % (input.size() - length + 1);
+        switch(random() % 4){
+            case 0: //random buttons
+                std::fill(input.begin() + first, input.begin() + first + length, (Byte) random());
+                break;
+            case 1:{ //a button toggled
+                Byte button = (Byte) (1 << random() % 8);
+                for(size_t frame = first; frame < first + length; frame++)
+                    input[frame] ^= button;
+                break;
+            }
+            case 2:{ //from an other input of the corpus, at the same frames
+                std::lock_guard<std::mutex> lock(mutex);
+                const std::vector<Byte> &other = corpus[random() % corpus.size()];
+                std::copy(other.begin() + first, other.begin() + first + length, input.begin() + first);
+                break;
+            }
+            case 3:{ //from an other place of the input (earlier or later)
+                size_t from = random() % (input.size() - length + 1);
+                std::vector<Byte> span(input.begin() + from, input.begin() + from + length);
+                std::copy(span.begin(), span.end(), input.begin() + first);
+                break;
+            }
+        }
+    }
+}
+
+
+bool FUZZER::is_new(const Result &result){
+    size_t new_addresses = 0;
+    for(size_t address = 0; address < covered.size(); address++)
+        if(result.coverage[address] && !covered[address]){
+            covered[address] = 1;
+            new_addresses++;
+        }
+    size_t new_features = 0;
+    for(uint32_t feature : result.features)
+        if(!seen[feature]){
+            seen[feature] = 1;
+            new_features++;
+        }
+    addresses += new_addresses;
+    features += new_features;
+    return new_addresses != 0 || new_features != 0;
+}
+
+
+
+void FUZZER::minimize(Worker &worker, std::vector<Byte> &input, Crash crash, Address pc){
+    int runs = 0;
+    //spans of half of the input, then of quarters...: each one is removed (the crash may come earlier) or else released
+    for(size_t length = input.size() / 2; length >= 1 && runs < MINIMIZE_RUNS; length /= 2){
+        size_t first = 0;
+        while(first < input.size() && runs < MINIMIZE_RUNS){
+            size_t last = std::min(first + length, input.size());
+            bool removed = false;
+            for(int release = 0; release < 2 && runs < MINIMIZE_RUNS; release++){
+                std::vector<Byte> candidate = input;
+                if(!release)
+                    candidate.erase(candidate.begin() + first, candidate.begin() + last);
+                else if(std::any_of(input.begin() + first, input.begin() + last, [](Byte buttons){ return buttons != 0x00; }))
+                    std::fill(candidate.begin() + first, candidate.begin() + last, 0x00);
+                else
+                    break;
+                play(worker, candidate);
+                runs++;
+                if(worker.result.crash == crash && worker.result.pc == pc){
+                    candidate.resize(worker.result.frame + 1); //it may crash earlier
+                    input.swap(candidate);
+                    removed = !release;
+                    break;
+                }
+            }
+            if(!removed) //else the next span is now at `first`
+                first += length;
+        }
+    }
+}
+
+
+void FUZZER::print_stats(){
+    report = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(report - begin).count();
+    std::printf("%llu runs (%.1f/s), %zu inputs, %zu addresses, %zu ram hashes, %zu crashes\n", (unsigned long long) done,
+                done / seconds, corpus.size(), addresses, features, crashes.size());
+    std::fflush(stdout);
+}
+
+
+
+int FUZZER::run(uint64_t runs, int frames, std::string directory){
+    this->directory = directory;
+    mkdir(directory.c_str(), 0755); //it may already exist
+
+    //every input has the same length: the seeds are cut or padded with released buttons
+    if(corpus.empty())
+        corpus.push_back(std::vector<Byte>());
+    for(std::vector<Byte> &seed : corpus)
+        seed.resize(frames, 0x00);
+    seeds = corpus.size();
+    covered.assign(0x10000, 0);
+    seen.assign(ram.size() << 16, 0);
+    begin = report = std::chrono::steady_clock::now();
+
+    //the seeds are played first as they are, then mutated inputs of the corpus
+    std::atomic<uint64_t> next(0);
+    uint64_t count = std::max<uint64_t>(runs, seeds);
+    workers.run([&](int index, int){
+        Worker &worker = instances[index];
+        std::vector<Byte> input;
+        for(uint64_t job = next++; job < count; job = next++){
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                input = corpus[job < seeds ? job : worker.random() % corpus.size()];
+            }
+            if(job >= seeds)
+                mutate(worker, input);
+            play(worker, input);
+
+            Crash crash = worker.result.crash;
+            Address pc = worker.result.pc;
+            bool added = false, crashed = false;
+            size_t number = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done++;
+                //the frames after a crash are not played, what came before counts: a crashing input is only kept as a crash
+                if(is_new(worker.result) && crash == NONE){
+                    corpus.push_back(input);
+                    number = corpus.size() - 1;
+                    added = true;
+                }
+                if(crash != NONE)
+                    crashed = crashes.insert(std::make_pair((int) crash, pc)).second;
+                if(std::chrono::steady_clock::now() - report >= std::chrono::seconds(2))
+                    print_stats();
+            }
+
+            char name[64];
+            if(added){
+                std::snprintf(name, sizeof(name), "/input-%06zu.mov", number);
+                MOVIE::record_input(directory + name, worker.nes, start, input);
+            }
+            if(crashed){
+                input.resize(worker.result.frame + 1);
+                minimize(worker, input, crash, pc);
+                play(worker, input); //for the frame and the opcode of the minimal input
+                Byte opcode = worker.nes->cpu->get_opcode();
+                int frame = worker.result.frame;
+                std::snprintf(name, sizeof(name), "/crash-%s-%04x.mov", crash == JAM ? "jam" : "stuck", pc);
+                bool written = MOVIE::record_input(directory + name, worker.nes, start, input);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if(crash == JAM)
+                    std::printf("crash: opcode $%02x at $%04x is not emulated, after %d frames", opcode, pc, frame + 1);
+                else
+                    std::printf("crash: stuck in a loop at $%04x after %d frames", pc, frame + 1);
+                std::printf(", %s%s\n", (directory + name).c_str(), written ? "" : " could not be written");
+                std::fflush(stdout);
+            }
+        }
+    });
+
+    print_stats();
+    return (int) crashes.size();
+}
@@ -0,0 +1,105 @@
+//
+//  fuzzer.hpp
+//  NES-Emulator
+//
+
+#ifndef fuzzer_hpp
+#define fuzzer_hpp
+
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+#include "workers.hpp"
+
+typedef uint8_t Byte;
+typedef uint16_t Address;
+
+class NES;
+
+
+//Looks for inputs which make the game do something new or crash, without window.
+//
+//An input is the buttons held on controller 1 during each frame (see INPUT), played from the start state.
+//The inputs of the corpus (the seeds, then every input which did something new) are mutated: spans of frames
+//are set to random buttons, get a button toggled, or are copied from an other input or an other place.
+//Each mutated input is played by a pool of threads (see WORKERS), each with its own NES (no video, no SDL call).
+//
+//Coverage: the addresses of the opcodes executed (see CPU::coverage) and the hashes of some RAM regions at the end
+//of each frame (16 bits of STATEHASH::hash per region). An input which reaches a new address or a new hash is added
+//to the corpus and written in the output directory as a movie (see MOVIE). The RAM regions should hold the state of
+//the game (level, position, mode...), a frame counter would make every input new.
+//The coverage of an input which crashes counts up to the frame of the crash, but the input is not added to the corpus.
+//
+//Crashes:
+//  jam: the cpu fetched an opcode which is not emulated and stopped on it (see CPU::is_jammed)
+//  stuck: in each of STUCK_FRAMES frames, no NMI was taken (its handler was not executed) and every opcode executed
+//         was within STUCK_RANGE bytes: a loop which waits for the NMI is not stuck
+//Each crash (kind and address) is kept once. Its input is minimized (the frames after the crash are dropped, then
+//as many spans of frames as possible are removed or released while it still crashes the same way) and written as a movie.
+class FUZZER{
+public:
+    struct Region{
+        Address first; //in the RAM
+        Address last;
+    };
+    static bool parse_regions(std::string text, std::vector<Region> &); //$0300-$03ff,$0040 ... false if it is not a list
+
+    FUZZER(std::string rom, const std::vector<Byte> &start, const std::vector<Region> &ram, int threads);
+
+    void add_seed(const std::vector<Byte> &input); //buttons of each frame
+    int run(uint64_t runs, int frames, std::string directory); //returns the number of crashes found
+
+private:
+    static const int STUCK_RANGE = 64;
+    static const int STUCK_FRAMES = 120;
+    static const int MINIMIZE_RUNS = 256; //at most, for each crash
+
+    enum Crash{ NONE, JAM, STUCK };
+    struct Result{
+        Crash crash = NONE;
+        Address pc = 0x0000;             //of the opcode not emulated, or the lowest address of the loop
+        int frame = 0;                   //where the crash was seen
+        std::vector<Byte> coverage;      //1 for each address where an opcode was executed
+        std::vector<uint32_t> features;  //region << 16 | hash, sorted
+    };
+    struct Worker{
+        NES *nes = NULL;
+        std::mt19937_64 random;
+        std::vector<Byte> frame_coverage; //given to the cpu, cleared at each frame
+        Result result;
+    };
+
+    std::string rom;
+    std::vector<Byte> start;
+    std::vector<Region> ram;
+    std::string directory;
+
+    WORKERS workers;
+    std::vector<Worker> instances; //one per thread
+
+    std::mutex mutex; //for all below
+    std::vector<std::vector<Byte>> corpus;
+    size_t seeds = 0;
+    std::vector<Byte> covered;  //addresses
+    std::vector<Byte> seen;     //features
+    size_t addresses = 0;       //covered
+    size_t features = 0;        //seen
+    std::set<std::pair<int, Address>> crashes;
+    uint64_t done = 0;          //runs
+    std::chrono::steady_clock::time_point begin, report;
+
+    void play(Worker &, const std::vector<Byte> &input);
+    void mutate(Worker &, std::vector<Byte> &input);
+    bool is_new(const Result &); //merges it in the coverage
+    void minimize(Worker &, std::vector<Byte> &input, Crash, Address);
+    void print_stats();
+};
+
+#endif /* fuzzer_hpp */
@@ -0,0 +1,101 @@
+//
+//  input.cpp
+//  NES-Emulator
+//
+
+#include "input.hpp"
+
+
+uint16_t INPUT::button(SDL_Scancode key){
+    switch(key){
+        //port 1, keyboard is handled as qwerty
+        case SDL_SCANCODE_K:        return 0x0080; //A
+        case SDL_SCANCODE_L:        return 0x0040; //B
+        case SDL_SCANCODE_G:        return 0x0020; //Select
+        case SDL_SCANCODE_H:        return 0x0010; //Start
+        case SDL_SCANCODE_W:        return 0x0008; //Up (z)
+        case SDL_SCANCODE_S:        return 0x0004; //Down
+        case SDL_SCANCODE_A:        return 0x0002; //Left (q)
+        case SDL_SCANCODE_D:        return 0x0001; //Right
+
+        //port 2
+        case SDL_SCANCODE_PERIOD:   return 0x8000;
+        case SDL_SCANCODE_COMMA:    return 0x4000;
+        case SDL_SCANCODE_RSHIFT:   return 0x2000;
+        case SDL_SCANCODE_RETURN:   return 0x1000;
+        case SDL_SCANCODE_UP:       return 0x0800;
+        case SDL_SCANCODE_DOWN:     return 0x0400;
+        case SDL_SCANCODE_LEFT:     return 0x0200;
+        case SDL_SCANCODE_RIGHT:    return 0x0100;
+
+        default:                    return 0x0000;
+    }
+}
+
+
+void INPUT::poll(){
+    SDL_Event event;
+    while(SDL_PollEvent(&event)){
+        switch(event.type){
+            case SDL_QUIT: //we quit if the user tells us to quit
+                quit = true;
+                break;
+
+            case SDL_KEYDOWN:{
+                if(event.key.repeat)
+                    break;
+                SDL_Scancode key = event.key.keysym.scancode;
+                if(key == SDL_SCANCODE_ESCAPE)
+                    quit = true;
+                else if(key == SDL_SCANCODE_P)
+                    paused = !paused;
+                else if(key == SDL_SCANCODE_TAB)
+                    fast_forward = true;
+                else if(key == SDL_SCANCODE_BACKSPACE)
+                    rewinding = true;
+                else if(key == SDL_SCANCODE_F5)
+                    save_request = true;
+                uint16_t bit = button(key);
+                uint16_t state = held.fetch_or(bit, std::memory_order_relaxed) | bit;
+                tapped.fetch_or(bit, std::memory_order_relaxed);
+                if(latency != NULL && bit)
+                    latency->input(state, bit);
+                break;
+            }
+
+            case SDL_KEYUP:
+                if(event.key.keysym.scancode == SDL_SCANCODE_TAB)
+                    fast_forward = false;
+                else if(event.key.keysym.scancode == SDL_SCANCODE_BACKSPACE)
+                    rewinding = false;
+            {
+                uint16_t bit = button(event.key.keysym.scancode);
+                uint16_t state = held.fetch_and((uint16_t) ~bit, std::memory_order_relaxed) & ~bit;
+                if(latency != NULL && bit)
+                    latency->input(state, bit);
+                break;
+            }
+
+            case SDL_WINDOWEVENT: //the key up events are lost when the window loses the focus
+                if(event.window.event == SDL_WINDOWEVENT_FOCUS_LOST){
+                    held = 0x0000;
+                    fast_forward = false;
+                    rewinding = false;
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+
+Byte INPUT::get(int port, bool latch){
+    uint16_t state = held.load(std::memory_order_relaxed);
+    if(latch)
+        state |= tapped.fetch_and((uint16_t) (port ? 0x00FF : 0xFF00), std::memory_order_relaxed);
+    else
+        state |= tapped.load(std::memory_order_relaxed);
+    return (Byte) (state >> (8 * port));
+}
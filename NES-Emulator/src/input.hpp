@@ -0,0 +1,67 @@
+//
+//  input.hpp
+//  NES-Emulator
+//
+
+#ifndef input_hpp
+#define input_hpp
+
+#include <atomic>
+#include <cstdint>
+
+//I know it's a weird way to include SDL but it's the only way I found to use SDL and CMake together
+#include "SDL.h"
+
+#include "latency.hpp"
+
+typedef uint8_t Byte;
+
+
+//Handles the SDL events and gives the state of the two controllers to the emulation.
+//
+//The frontend drains the whole event queue at each poll(). The state of both controllers is one atomic
+//word (port 1 in the low byte, port 2 in the high byte): the emulation reads it when the game strobes
+//$4016, it never waits and never calls SDL.
+//A button pressed and released between two reads of the game is still seen once (tapped).
+//
+//Quitting and pausing are commands the emulation checks, nothing calls exit() behind its back.
+//
+//controller bits:  7 - A, 6 - B, 5 - Select, 4 - Start, 3 - Up, 2 - Down, 1 - Left, 0 - Right
+//(the order in which the game reads them)
+//
+//keys (qwerty):    port 1: WASD, G select, H start, K A, L B
+//                  port 2: arrows, right shift select, return start, period A, comma B
+//                  P pause, tab (held) fast forward, backspace (held) rewind,
+//                  F5 save state, escape quit
+class INPUT{
+private:
+    std::atomic<uint16_t> held{0x0000};    //buttons currently down
+    std::atomic<uint16_t> tapped{0x0000};  //buttons pressed since the last latch
+    std::atomic<bool> quit{false};
+    std::atomic<bool> paused{false};
+    std::atomic<bool> fast_forward{false};
+    std::atomic<bool> rewinding{false};
+    std::atomic<bool> save_request{false};
+
+    LATENCY *latency = NULL;
+
+    static uint16_t button(SDL_Scancode);  //bit of this key in held, 0 if it is not mapped
+
+public:
+    //frontend (the thread which owns the window)
+    void poll();
+    void request_quit(){ quit = true; }
+    void set_latency(LATENCY *latency){ this->latency = latency; } //before the emulation starts
+    void hold(uint16_t buttons){ held = buttons; } //without frontend (see SEARCH)
+
+    //emulation
+    //latch: the game latched the controller (end of the strobe), the tapped buttons are consumed
+    Byte get(int port, bool latch);
+    bool should_quit(){ return quit.load(std::memory_order_relaxed); }
+    bool is_paused(){ return paused.load(std::memory_order_relaxed); }
+    bool is_fast_forward(){ return fast_forward.load(std::memory_order_relaxed); }
+    bool is_rewinding(){ return rewinding.load(std::memory_order_relaxed); }
+    bool take_save_request(){ return save_request.exchange(false, std::memory_order_relaxed); }
+};
+
+#endif /* input_hpp */
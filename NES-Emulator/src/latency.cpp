@@ -0,0 +1,196 @@
+//
+//  latency.cpp
+//  NES-Emulator
+//
+
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+
+#include "latency.hpp"
+
+
+LATENCY::LATENCY(std::string path){
+    this->path = path;
+}
+
+
+
+uint64_t LATENCY::hash(const Frame &frame){
+    //only used to know whether two frames differ
+    const int WORDS = sizeof(Frame) / sizeof(uint64_t);
+    uint64_t h = 0xcbf29ce484222325;
+    for(int i = 0; i < WORDS; i++){
+        uint64_t word;
+        std::memcpy(&word, reinterpret_cast<const char *>(frame.data()) + i * sizeof(uint64_t), sizeof(uint64_t));
+        h = (h ^ word) * 0x100000001b3;
+    }
+    return h;
+}
+
+double LATENCY::ms(Clock::duration duration){
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+
+
+void LATENCY::input(uint16_t state, uint16_t changed){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(events.size() >= MAX_EVENTS){
+        if(dropped++ == 0)
+            std::cout << "The latency log is full (" << MAX_EVENTS << " events), the next inputs are not measured" << std::endl;
+        return;
+    }
+    Event event = {};
+    event.stage = RECEIVED;
+    event.state = state;
+    event.changed = changed;
+    event.input = Clock::now();
+    event.since = last_sequence;
+    events.push_back(event);
+}
+
+void LATENCY::latched(uint16_t state, uint64_t dot){
+    std::lock_guard<std::mutex> lock(mutex);
+    //the changes whose buttons have their new state in the latched value are read (the tapped buttons make a press
+    //released before the latch read), the older changes of the same buttons were undone before the game saw them
+    Clock::time_point now = Clock::now();
+    for(size_t i = first_pending; i < events.size(); i++){
+        if(events[i].stage != RECEIVED || ((state ^ events[i].state) & events[i].changed) != 0)
+            continue;
+        events[i].stage = READ;
+        events[i].read_dot = dot;
+        events[i].read = now;
+        events[i].reference = last_hash;
+        events[i].since = last_sequence;
+        for(size_t j = first_pending; j < i; j++)
+            if(events[j].stage == RECEIVED && (events[j].changed & events[i].changed) != 0){
+                events[j].stage = UNANSWERED;
+                unanswered++;
+            }
+    }
+}
+
+void LATENCY::published(const Frame &frame, unsigned int sequence){
+    uint64_t h = hash(frame); //out of the lock
+    std::lock_guard<std::mutex> lock(mutex);
+    Clock::time_point now = Clock::now();
+    for(size_t i = first_pending; i < events.size(); i++){
+        if(events[i].stage == READ && h != events[i].reference){
+            events[i].stage = RESPONDED;
+            events[i].frame = sequence;
+            events[i].published = now;
+        }
+        else if((events[i].stage == RECEIVED || events[i].stage == READ) && sequence - events[i].since > MAX_WAIT){
+            events[i].stage = UNANSWERED;
+            unanswered++;
+        }
+    }
+    last_hash = h;
+    last_sequence = sequence;
+    retire();
+}
+
+void LATENCY::presented(unsigned int sequence){
+    std::lock_guard<std::mutex> lock(mutex);
+    Clock::time_point now = Clock::now();
+    for(size_t i = first_pending; i < events.size(); i++)
+        if(events[i].stage == RESPONDED && events[i].frame <= sequence){
+            events[i].stage = PRESENTED;
+            events[i].presented = now;
+        }
+    retire();
+}
+
+void LATENCY::retire(){
+    while(first_pending < events.size() && (events[first_pending].stage == PRESENTED || events[first_pending].stage == UNANSWERED))
+        first_pending++;
+}
+
+
+
+void LATENCY::write(){
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const int STEPS = 4;
+    const char *names[STEPS] = {"input_to_read_ms", "read_to_published_ms", "published_to_presented_ms", "total_ms"};
+    std::vector<double> values[STEPS];
+    std::vector<const Event *> done;
+    for(const Event &event : events)
+        if(event.stage == PRESENTED){
+            done.push_back(&event);
+            values[0].push_back(ms(event.read - event.input));
+            values[1].push_back(ms(event.published - event.read));
+            values[2].push_back(ms(event.presented - event.published));
+            values[3].push_back(ms(event.presented - event.input));
+        }
+
+    //nearest rank percentiles
+    const int PERCENTILES = 4;
+    const double ranks[PERCENTILES] = {50, 90, 99, 100};
+    const char *percentile_names[PERCENTILES] = {"p50", "p90", "p99", "max"};
+    double percentiles[STEPS][PERCENTILES] = {};
+    for(int s = 0; s < STEPS; s++){
+        std::vector<double> sorted = values[s];
+        std::sort(sorted.begin(), sorted.end());
+        for(int p = 0; p < PERCENTILES && !sorted.empty(); p++){
+            size_t rank = (size_t) (ranks[p] / 100 * sorted.size() + 0.999999);
+            percentiles[s][p] = sorted[std::max<size_t>(rank, 1) - 1];
+        }
+    }
+
+    std::ofstream file(path);
+    if(!file){
+        std::cout << "Could not write the latency log " << path << std::endl;
+        return;
+    }
+    file << std::fixed << std::setprecision(3);
+
+    bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    if(json){
+        file << "{\n  \"events\": [";
+        for(size_t i = 0; i < done.size(); i++){
+            file << (i ? ",\n" : "\n") << "    {\"state\": " << done[i]->state << ", \"read_dot\": " << done[i]->read_dot
+                 << ", \"frame\": " << done[i]->frame;
+            for(int s = 0; s < STEPS; s++)
+                file << ", \"" << names[s] << "\": " << values[s][i];
+            file << "}";
+        }
+        file << "\n  ],\n  \"unanswered\": " << unanswered << ",\n  \"dropped\": " << dropped << ",\n  \"percentiles\": {";
+        for(int s = 0; s < STEPS; s++){
+            file << (s ? ",\n" : "\n") << "    \"" << names[s] << "\": {";
+            for(int p = 0; p < PERCENTILES; p++)
+                file << (p ? ", " : "") << "\"" << percentile_names[p] << "\": " << percentiles[s][p];
+            file << "}";
+        }
+        file << "\n  }\n}\n";
+    }
+    else{
+        file << "state,read_dot,frame";
+        for(int s = 0; s < STEPS; s++)
+            file << "," << names[s];
+        file << "\n";
+        for(size_t i = 0; i < done.size(); i++){
+            file << "0x" << std::hex << std::setw(4) << std::setfill('0') << done[i]->state << std::dec << std::setfill(' ')
+                 << "," << done[i]->read_dot << "," << done[i]->frame;
+            for(int s = 0; s < STEPS; s++)
+                file << "," << values[s][i];
+            file << "\n";
+        }
+        for(int s = 0; s < STEPS; s++){
+            file << "# " << names[s];
+            for(int p = 0; p < PERCENTILES; p++)
+                file << " " << percentile_names[p] << "=" << percentiles[s][p];
+            file << "\n";
+        }
+        file << "# unanswered=" << unanswered << " dropped=" << dropped << "\n";
+    }
+
+    std::cout << done.size() << " input events written to " << path << ", total latency p50 " << percentiles[3][0]
+              << " ms, p99 " << percentiles[3][2] << " ms";
+    if(unanswered != 0 || dropped != 0)
+        std::cout << " (" << unanswered << " unanswered, " << dropped << " not measured)";
+    std::cout << std::endl;
+}
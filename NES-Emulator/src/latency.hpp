@@ -0,0 +1,78 @@
+//
+//  latency.hpp
+//  NES-Emulator
+//
+
+#ifndef latency_hpp
+#define latency_hpp
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+#include "screen.hpp"
+
+
+//Measures the input latency from end to end.
+//For each change of the controllers it records:
+//  - when the frontend received it
+//  - the dot and the time at which the game latched it ($4016): the first latch whose value has the buttons it changed
+//    in their new state (a press is seen by the latch which follows it, even if the button was released before)
+//  - the first published frame which differs from the last frame published before that read (the response)
+//  - when the presenter showed that frame (or a newer one, if it was replaced before it could be shown)
+//The response is only meaningful on screens which do not change by themselves (menus, a paused game, test roms).
+//A change which is not read, or gets no response, within MAX_WAIT frames is counted as unanswered and dropped
+//(the game did not poll), as is a change undone by a later one before the game read it (a release and a new
+//press between two reads: the game only sees the button held).
+//
+//The events are written to a CSV file (or JSON if the name ends with .json) with the percentiles
+//of each step when the emulator quits.
+class LATENCY{
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    enum Stage { RECEIVED, READ, RESPONDED, PRESENTED, UNANSWERED };
+    struct Event{
+        Stage stage;
+        uint16_t state;            //controllers after the change (port 1 in the low byte)
+        uint16_t changed;          //buttons
+        Clock::time_point input;
+        uint64_t read_dot;
+        Clock::time_point read;
+        uint64_t reference;        //hash of the last frame published before the read
+        unsigned int frame;        //sequence number of the response
+        Clock::time_point published;
+        Clock::time_point presented;
+        unsigned int since;        //sequence of the last frame published when it was received or read
+    };
+
+    static const size_t MAX_EVENTS = 100000;
+    static const unsigned int MAX_WAIT = 60; //frames
+
+    std::string path;
+    std::mutex mutex; //the events come from the frontend, the emulation and the presenter
+    std::vector<Event> events;
+    size_t first_pending = 0;     //events before it are presented or unanswered
+    uint64_t last_hash = 0;
+    unsigned int last_sequence = 0;
+    size_t unanswered = 0;
+    size_t dropped = 0;           //after MAX_EVENTS
+
+    static uint64_t hash(const Frame &);
+    static double ms(Clock::duration);
+    void retire(); //first_pending after the events which are over
+
+public:
+    LATENCY(std::string path);
+
+    void input(uint16_t state, uint16_t changed);        //frontend: the controllers changed
+    void latched(uint16_t state, uint64_t dot);          //emulation: the game latched the controllers in this state
+    void published(const Frame &, unsigned int sequence); //a frame was published
+    void presented(unsigned int sequence);               //presenter: this frame is on the screen
+
+    void write(); //when the emulator quits
+};
+
+#endif /* latency_hpp */
@@ -0,0 +1,307 @@
+//
+//  movie.cpp
+//  NES-Emulator
+//
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <algorithm>
+
+#include "movie.hpp"
+#include "packing.hpp"
+#include "nes.hpp"
+
+
+MOVIE *MOVIE::record(std::string path, NES *nes, uint64_t keyframe_interval){
+    MOVIE *movie = new MOVIE;
+    movie->recording = true;
+    movie->path = path;
+    movie->rom = nes->cartridge->hash;
+    movie->keyframe_interval = keyframe_interval;
+    movie->start.resize(NES::state_size());
+    movie->state.resize(NES::state_size());
+    nes->save_state(movie->start.data(), movie->start.size());
+    return movie;
+}
+
+
+MOVIE *MOVIE::play(std::string path, NES *nes){
+    std::ifstream file(path, std::ios::binary);
+    if(!file.is_open()){
+        std::cout << "Cannot open the movie " << path << std::endl;
+        return NULL;
+    }
+    std::vector<Byte> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    Header header;
+    if(data.size() < sizeof(Header)){
+        std::cout << path << " is not a movie" << std::endl;
+        return NULL;
+    }
+    std::memcpy(&header, data.data(), sizeof(Header));
+    if(header.magic != MAGIC || header.version != VERSION || header.state_size != NES::state_size()){
+        std::cout << path << " is not a movie of this version of the emulator" << std::endl;
+        return NULL;
+    }
+    //the sizes are checked before anything is allocated
+    if(header.packed_size > data.size() - sizeof(Header) || header.index > data.size()
+       || header.keyframes > (data.size() - header.index) / sizeof(Keyframe)
+       || header.frames > MAX_FRAMES || header.values > MAX_VALUES){
+        std::cout << "The movie " << path << " is corrupt" << std::endl;
+        return NULL;
+    }
+    if(header.rom != nes->cartridge->hash){
+        std::cout << "The movie " << path << " was recorded with an other game" << std::endl;
+        return NULL;
+    }
+
+    MOVIE *movie = new MOVIE;
+    movie->recording = false;
+    movie->path = path;
+    movie->start.resize(header.state_size);
+    movie->state.resize(header.state_size);
+    size_t position = sizeof(Header);
+    bool complete = unpack_runs(data.data() + position, header.packed_size, movie->start.data(), movie->start.size());
+    position += header.packed_size;
+
+    //each run is checked against what is left of the counts of the header
+    while(complete && movie->polls.size() < header.frames){
+        uint64_t frames, values;
+        complete = read_varint(data.data(), data.size(), position, frames) && read_varint(data.data(), data.size(), position, values)
+                   && frames != 0 && frames <= header.frames - movie->polls.size() && values <= MAX_VALUES_PER_FRAME;
+        if(complete)
+            movie->polls.insert(movie->polls.end(), frames, (uint32_t) values);
+    }
+    while(complete && movie->values.size() < header.values){
+        uint64_t count;
+        complete = read_varint(data.data(), data.size(), position, count) && position < data.size()
+                   && count != 0 && count <= header.values - movie->values.size();
+        if(complete)
+            movie->values.insert(movie->values.end(), count, data[position++]);
+    }
+    while(complete && movie->buttons.size() < header.frames){
+        uint64_t frames;
+        complete = read_varint(data.data(), data.size(), position, frames) && position < data.size()
+                   && frames != 0 && frames <= header.frames - movie->buttons.size();
+        if(complete)
+            movie->buttons.insert(movie->buttons.end(), frames, data[position++]);
+    }
+    if(!complete){
+        std::cout << "The movie " << path << " is corrupt" << std::endl;
+        delete movie;
+        return NULL;
+    }
+
+    movie->first_values.push_back(0);
+    for(uint32_t values : movie->polls)
+        movie->first_values.push_back(movie->first_values.back() + values);
+    if(movie->first_values.back() != movie->values.size()){ //the frames do not read the values of the movie
+        std::cout << "The movie " << path << " is corrupt" << std::endl;
+        delete movie;
+        return NULL;
+    }
+
+    //each keyframe must be in the file, at a frame of the movie, in order
+    movie->index.resize(header.keyframes);
+    if(header.keyframes != 0)
+        std::memcpy(movie->index.data(), data.data() + header.index, header.keyframes * sizeof(Keyframe));
+    for(size_t k = 0; k < movie->index.size(); k++){
+        const Keyframe &keyframe = movie->index[k];
+        if(keyframe.offset > data.size() || keyframe.size > data.size() - keyframe.offset || keyframe.frame > movie->polls.size()
+           || (k != 0 && keyframe.frame <= movie->index[k - 1].frame)){
+            std::cout << "The movie " << path << " is corrupt" << std::endl;
+            delete movie;
+            return NULL;
+        }
+    }
+    movie->keyframes.swap(data); //the keyframes are unpacked when we seek
+
+    if(!nes->load_state(movie->start.data(), movie->start.size())){
+        std::cout << "The movie " << path << " can not be played" << std::endl;
+        delete movie;
+        return NULL;
+    }
+    if(!movie->polls.empty())
+        movie->frame_end = movie->polls[0];
+    return movie;
+}
+
+
+
+bool MOVIE::record_input(std::string path, NES *nes, const std::vector<Byte> &start, const std::vector<Byte> &buttons){
+    //played again from the start, the controller reads are recorded
+    nes->load_state(start.data(), start.size());
+    MOVIE *movie = record(path, nes);
+    MOVIE *previous = nes->movie;
+    nes->movie = movie;
+    for(Byte held : buttons){
+        nes->input->hold(held);
+        nes->run_frame();
+        movie->frame_start(nes);
+    }
+    nes->movie = previous;
+    bool written = movie->write();
+    delete movie;
+    return written;
+}
+
+
+
+bool MOVIE::seek(uint64_t frame, NES *nes){
+    if(recording || frame > polls.size())
+        return false;
+
+    //last keyframe at or before the frame
+    std::vector<Keyframe>::iterator keyframe = index.end();
+    for(std::vector<Keyframe>::iterator k = index.begin(); k != index.end() && k->frame <= frame; k++)
+        keyframe = k;
+
+    if(keyframe == index.end()){
+        nes->load_state(start.data(), start.size());
+        set_frame(0);
+    }
+    else{
+        if(!unpack_runs(keyframes.data() + keyframe->offset, keyframe->size, state.data(), state.size())){
+            std::cout << "The keyframe of frame " << keyframe->frame << " of the movie " << path << " is corrupt" << std::endl;
+            return false;
+        }
+        for(size_t i = 0; i < state.size(); i++)
+            state[i] ^= start[i];
+        nes->load_state(state.data(), state.size());
+        set_frame(keyframe->frame);
+    }
+    return true;
+}
+
+void MOVIE::set_frame(uint64_t frame){
+    this->frame = frame;
+    next = first_values[frame];
+    frame_end = first_values[std::min<size_t>(frame + 1, polls.size())];
+    desynchronized = false;
+}
+
+Byte MOVIE::get_buttons(uint64_t frame){
+    if(recording || frame >= buttons.size())
+        return 0x00;
+    return buttons[frame];
+}
+
+
+void MOVIE::add_keyframe(NES *nes){
+    nes->save_state(state.data(), state.size());
+    for(size_t i = 0; i < state.size(); i++) //most of the state did not change since the start
+        state[i] ^= start[i];
+    size_t offset = keyframes.size();
+    keyframes.resize(offset + 2 * state.size() + 10);
+    size_t size = pack_runs(state.data(), state.size(), keyframes.data() + offset);
+    keyframes.resize(offset + size);
+    Keyframe keyframe = {frame, offset, size}; //offset from the first keyframe until the file is written
+    index.push_back(keyframe);
+}
+
+
+
+void MOVIE::recorded(Byte value, int port, bool latch){
+    values.push_back(value);
+    current++;
+    if(port == 0 && latch)
+        latched = value;
+}
+
+Byte MOVIE::played(){
+    if(next >= frame_end){ //the game reads more than it did
+        desynchronized = true;
+        return 0x00;
+    }
+    return values[next++];
+}
+
+
+void MOVIE::frame_start(NES *nes){
+    if(recording){
+        polls.push_back(current);
+        buttons.push_back(latched);
+        current = 0;
+        frame++;
+        if(keyframe_interval != 0 && frame % keyframe_interval == 0)
+            add_keyframe(nes);
+        return;
+    }
+    if(frame >= polls.size())
+        return;
+
+    if(next != frame_end && !desynchronized){
+        std::cout << "The movie desynchronized at frame " << frame << std::endl;
+        desynchronized = true;
+    }
+    next = frame_end;
+    frame++;
+    if(frame < polls.size())
+        frame_end += polls[frame];
+    else
+        std::cout << "The movie is over (" << polls.size() << " frames), the controllers are live" << std::endl;
+}
+
+
+
+bool MOVIE::write(){
+    //the frame which was not over is not part of the movie
+    values.resize(values.size() - current);
+    current = 0;
+
+    std::vector<Byte> data(sizeof(Header) + 2 * start.size() + 10);
+    size_t position = sizeof(Header);
+    size_t packed = pack_runs(start.data(), start.size(), data.data() + position);
+    data.resize(position + packed);
+
+    Byte varint[21];
+    for(size_t i = 0; i < polls.size();){
+        size_t run = 1;
+        while(i + run < polls.size() && polls[i + run] == polls[i])
+            run++;
+        size_t length = write_varint(run, varint);
+        length += write_varint(polls[i], varint + length);
+        data.insert(data.end(), varint, varint + length);
+        i += run;
+    }
+    for(size_t i = 0; i < values.size();){
+        size_t run = 1;
+        while(i + run < values.size() && values[i + run] == values[i])
+            run++;
+        size_t length = write_varint(run, varint);
+        varint[length++] = values[i];
+        data.insert(data.end(), varint, varint + length);
+        i += run;
+    }
+    for(size_t i = 0; i < buttons.size();){
+        size_t run = 1;
+        while(i + run < buttons.size() && buttons[i + run] == buttons[i])
+            run++;
+        size_t length = write_varint(run, varint);
+        varint[length++] = buttons[i];
+        data.insert(data.end(), varint, varint + length);
+        i += run;
+    }
+
+    size_t first_keyframe = data.size();
+    data.insert(data.end(), keyframes.begin(), keyframes.end());
+    size_t index_offset = data.size();
+    for(Keyframe keyframe : index){
+        keyframe.offset += first_keyframe;
+        const Byte *bytes = reinterpret_cast<const Byte *>(&keyframe);
+        data.insert(data.end(), bytes, bytes + sizeof(Keyframe));
+    }
+
+    Header header = {MAGIC, VERSION, rom, polls.size(), values.size(), start.size(), packed, index.size(), index_offset};
+    std::memcpy(data.data(), &header, sizeof(Header));
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    if(!file){
+        std::cout << "Could not write the movie " << path << std::endl;
+        return false;
+    }
+    std::cout << polls.size() << " frames recorded in " << path << " (" << data.size() << " bytes, " << index.size() << " keyframes)" << std::endl;
+    return true;
+}
@@ -0,0 +1,117 @@
+//
+//  movie.hpp
+//  NES-Emulator
+//
+
+#ifndef movie_hpp
+#define movie_hpp
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+typedef uint8_t Byte;
+
+class NES;
+
+
+//Records what the game reads from the controllers and plays it back.
+//
+//The emulation is deterministic (the memory is cleared at power-up): from the same state, with the same values
+//read from the controllers, the game does exactly the same thing. A movie is the save state it starts from
+//(the power-up state, or the resumed or loaded state) and every value given to the controller shift registers
+//($4016 strobes and reads while strobing), with the number of values read in each frame. It also keeps the buttons
+//of controller 1 as the game latched them in each frame (the last ones if it did not latch them), for the tools
+//which replay the input with other states (see FUZZER).
+//Playing a movie back loads its state and gives the game the same values, whatever the keyboard does. If a frame
+//does not read as many values as it did (an other version of the emulator), the movie desynchronized.
+//
+//Seeking: a movie can hold a save state every `keyframe_interval` frames (keyframes). To go to a frame, the last
+//keyframe before it is loaded and only the frames after it are emulated.
+//
+//file (numbers in the byte order of the machine, like the save states):
+//  header, save state (runs, see packing.hpp)
+//  values per frame: [frames (varint)][values (varint)] ...
+//  values: [count (varint)][value] ...
+//  buttons of controller 1 per frame: [frames (varint)][buttons] ...
+//  keyframes: XOR with the first save state (runs)
+//  index of the keyframes: [frame][offset][size] (64 bits each)
+class MOVIE{
+private:
+    static const uint32_t MAGIC = 0x4d53454e; //"NESM"
+    static const uint32_t VERSION = 3;
+    //a movie file claiming more is corrupt
+    static const uint64_t MAX_FRAMES = 60ull * 60 * 60 * 24;     //a day
+    static const uint64_t MAX_VALUES_PER_FRAME = 2 * 29781 / 4;  //a strobe ($4016 write) every 4 cpu cycles, both ports
+    static const uint64_t MAX_VALUES = 16 * MAX_FRAMES;
+
+    struct Header{
+        uint32_t magic;
+        uint32_t version;
+        uint64_t rom;        //CARTRIDGE::hash
+        uint64_t frames;
+        uint64_t values;
+        uint64_t state_size;
+        uint64_t packed_size; //of the save state
+        uint64_t keyframes;
+        uint64_t index;       //offset of the index
+    };
+    struct Keyframe{
+        uint64_t frame;       //the state is the one at the start of this frame
+        uint64_t offset;      //in the file
+        uint64_t size;
+    };
+
+    bool recording;
+    std::string path;
+    uint64_t rom = 0;
+    std::vector<Byte> start;        //save state
+    std::vector<Byte> values;       //read from the controllers, in order
+    std::vector<uint32_t> polls;    //number of values of each frame
+    std::vector<Byte> buttons;      //of controller 1, latched during each frame
+    Byte latched = 0x00;            //recording: last buttons of controller 1 latched
+    uint64_t frame = 0;             //frames since the start
+    uint32_t current = 0;           //values of the frame being recorded
+    size_t next = 0;                //next value played
+    size_t frame_end = 0;           //first value of the next frame
+    bool desynchronized = false;
+
+    uint64_t keyframe_interval = 0; //recording, 0: no keyframe
+    std::vector<Keyframe> index;
+    std::vector<Byte> keyframes;   //recording: packed keyframes, playing: the whole file
+    std::vector<Byte> state;
+    std::vector<uint64_t> first_values; //playing: first value of each frame
+
+    MOVIE(){}
+    void add_keyframe(NES *);
+
+public:
+    static MOVIE *record(std::string path, NES *, uint64_t keyframe_interval = 0); //starts from the current state
+    static MOVIE *play(std::string path, NES *);   //loads its state, NULL if it can not be played with this game
+    //loads the start state, plays the buttons of controller 1 held in each frame and writes them as a movie (see SEARCH)
+    static bool record_input(std::string path, NES *, const std::vector<Byte> &start, const std::vector<Byte> &buttons);
+
+    bool is_recording(){ return recording; }
+    bool is_playing(){ return !recording && frame < polls.size(); } //false once the movie is over
+    bool is_desynchronized(){ return desynchronized; }
+    uint64_t get_frames(){ return recording ? frame : polls.size(); }
+    uint64_t get_frame(){ return frame; } //frames played or recorded so far
+
+    //playing: loads the last keyframe before this frame (or the first state), the frames up to it must then be emulated
+    //false if the movie is shorter or the keyframe is corrupt
+    bool seek(uint64_t frame, NES *);
+    //playing: the state of the start of this frame (at most get_frames()) was loaded by the caller
+    void set_frame(uint64_t frame);
+    //playing: buttons of controller 1 latched by the game during this frame (see FUZZER)
+    Byte get_buttons(uint64_t frame);
+
+    //emulation
+    void recorded(Byte value, int port, bool latch); //a value was given to a controller
+    Byte played();             //value to read from the controllers
+    void frame_start(NES *);
+
+    bool write(); //recording: when the emulation is over
+};
+
+#endif /* movie_hpp */
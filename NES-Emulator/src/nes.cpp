@@ -6,11 +6,27 @@
 //
 //#include <cstdio>
 #include <array>
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <thread>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <iomanip>
 #include <boost/program_options.hpp>
 
 #include "nes.hpp"
 #include "ppu.hpp"
 #include "cartridge.hpp"
+#include "filter.hpp"
+#include "presenter.hpp"
+#include "deferred.hpp"
+#include "parallel.hpp"
+#include "bisect.hpp"
+#include "search.hpp"
+#include "fuzzer.hpp"
 
 
 
@@ -32,97 +48,43 @@ void NES::write(Address adr, Byte content){
         this->ram->at(adr & 0x07FF) = content;
     }
     else if(adr <= 0x3FFF){
-        //The PPU exposes eight memory-mapped registers to the CPU. These nominally sit at $2000 through $2007 in the CPU's address space, but because they're incompletely decoded, they're mirrored in every 8 bytes from $2008 through $3FFF, so a write to $3456 is the same as a write to $2006.
-        switch (adr % 8) {
-            case 0: //ppuctrl
-                this->ppu->setPPUCTRL(content);
-                //https://wiki.nesdev.org/w/index.php?title=PPU_scrolling
-                //t: ... GH.. .... .... <- d: ......GH
-                this->ppu->addr_t = (this->ppu->addr_t & 0xF3FF) | ((content & 0x03) << 10);
-                break;
-                
-            case 1: //ppumask
-                this->ppu->setPPUMASK(content);
-                break;
-  
-            case 3:
-                ppu->setOAMADDR(content);
-                break;
-
-            case 4:
-                ppu->setOAMDATA(content);
-                break;
-                
-            case 5:{
-                //https://wiki.nesdev.org/w/index.php?title=PPU_scrolling
-                //t: ....... ...ABCDE <- d: ABCDE...
-                //x:              FGH <- d: .....FGH
-                //w:                  <- 1
-                if(!this->ppu->write_toggle){//first write
-                    this->ppu->addr_t = (this->ppu->addr_t & 0xFFE0) | (content >> 3);
-                    this->ppu->fine_x_scroll = content & 0x07;
-                    this->ppu->write_toggle = true;
-                }
-                //t: FGH ..AB CDE. .... <- d: ABCDEFGH
-                //w:                  <- 0
-                else{//second write
-//                    this->ppu->addr_t = ((((content & 0x07) << 12) | (this->ppu->addr_t & 0x0FFF)) & 0xFC1F) | ((content & 0xF8) << 5);
-                    this->ppu->addr_t &= 0x0C1F;
-                    this->ppu->addr_t |= ((content >> 3) << 5);
-                    this->ppu->addr_t |= ((content & 0x7) << 12);
-                    this->ppu->write_toggle = false;
-                }
-                break;
-            }
-
-            case 6:{
-                //https://wiki.nesdev.org/w/index.php?title=PPU_scrolling
-                //t: .CD EFGH .... .... <- d: ..CD EFGH
-                //       <unused>     <- d: AB......
-                //t: Z.. .... .... .... <- 0 (bit Z is cleared)
-                //w:                  <- 1
-                if(!this->ppu->write_toggle){//first write
-                    this->ppu->addr_t &= 0x00FF;
-                    this->ppu->addr_t |= (( (Address) (content & 0x3F) << 8));
-//                    this->ppu->addr_t = (this->ppu->addr_t & 0x00FF) | ((content & 0x3F) << 8);
-                    this->ppu->write_toggle = true;
-                }
-                //t: ....... ABCDEFGH <- d: ABCDEFGH
-                //v: <...all bits...> <- t: <...all bits...>
-                //w:                  <- 0
-                else{//second write
-                    //Valid addresses are $0000-$3FFF; higher addresses will be mirrored down.
-                    this->ppu->addr_t = (this->ppu->addr_t & 0xFF00) | content;
-                    this->ppu->vmem_addr = this->ppu->addr_t;
-                    this->ppu->write_toggle = false;
-                }
-                break;
-            }
-                
-            case 7:{ //you can read or write data from VRAM through this port
-                this->ppu->write(this->ppu->vmem_addr, content);
-
-                //VRAM read/write data register. After access, the video memory address will increment by an amount determined by bit 2 of $2000.
-                //(0: add 1, going across; 1: add 32, going down)
-                if(this->ppu->getPPUCTRL() & 0x04)
-                    this->ppu->vmem_addr += 32;
-                else
-                    this->ppu->vmem_addr += 1;
-                break;
-            }
-                
-            //some registers are read-only
-            default:
-                break;
-        }
+        if(this->ppu_access())
+            this->ppu->write_register(adr, content);
     }
     else if(adr == 0x4014){//initiate a DMA transfer
+        if(!this->ppu_access())
+            return;
         this->ppu->setOAMDMA(content);
         this->transfert_dma = true;
     }
-    //else if(adr == 0x4016){
-        //the controller state is update at each new frame
-    //}
+    else if(adr == 0x4016){
+        //while the strobe bit is set the controllers keep reloading their shift register with the buttons,
+        //they are latched when it is cleared
+        if(this->strobe || (content & 0x01)){
+            bool latch = !(content & 0x01);
+            bool replayed = this->parallel != NULL && this->parallel->is_replaying(); //this latch was already counted
+            this->controler_shifter[0] = this->controller(0, latch);
+            this->controler_shifter[1] = this->controller(1, latch);
+            if(latch && this->latency != NULL && !replayed)
+                this->latency->latched((this->controler_shifter[1] << 8) | this->controler_shifter[0], this->ppu->get_dots());
+        }
+        this->strobe = content & 0x01;
+    }
+}
+
+
+Byte NES::controller(int port, bool latch){
+    if(this->movie != NULL && this->movie->is_playing())
+        return this->movie->played();
+    Byte value;
+    if(this->parallel != NULL && this->parallel->replay_controller(value)) //the cpu rolled back
+        return value;
+    value = this->input->get(port, latch);
+    if(this->parallel != NULL)
+        this->parallel->controller_read(value);
+    if(this->movie != NULL && this->movie->is_recording())
+        this->movie->recorded(value, port, latch);
+    return value;
 }
 
 
@@ -132,59 +94,24 @@ Byte NES::read(Address addr){
         return this->ram->at(addr & 0x07FF);
     }
     else if(addr <= 0x3FFF){
-        //The PPU exposes eight memory-mapped registers to the CPU. These nominally sit at $2000 through $2007 in the CPU's address space, but because they're incompletely decoded, they're mirrored in every 8 bytes from $2008 through $3FFF, so a write to $3456 is the same as a write to $2006.
-        switch (addr % 8) {
-            case 2:{
-                Byte buffer = this->ppu->getPPUSTATUS(); //reading the register affect it's value
-                this->ppu->setPPUSTATUS(buffer & 0x7F); //Reading the status register will clear bit 7
-                this->ppu->write_toggle = false;  //Reading the status register will clear the address latch used by PPUSCROLL and PPUADDR.
-                return buffer;
-                break;
-            }
-
-            case 4:{
-                return this->ppu->getOAMDATA();
-                break;
-            }
-                
-            case 7:{
-                //When reading while the VRAM address is in the range 0-$3EFF (i.e., before the palettes), the read will return the contents of an internal read buffer. This internal buffer is updated only when reading PPUDATA, and so is preserved across frames. After the CPU reads and gets the contents of the internal buffer, the PPU will immediately update the internal buffer with the byte at the current VRAM address. Thus, after setting the VRAM address, one should first read this register to prime the pipeline and discard the result.
-                //Reading palette data from $3F00-$3FFF works differently. The palette data is placed immediately on the data bus, and hence no priming read is required. Reading the palettes still updates the internal buffer though, but the data placed in it is the mirrored nametable data that would appear "underneath" the palette.
-                Byte buffer = this->ppu->read_buffer;
-                this->ppu->read_buffer = this->ppu->read(this->ppu->vmem_addr);
-                
-                Byte data_to_return = 0x00;
-                
-                if(this->ppu->vmem_addr <= 0x3EFF)
-                    data_to_return = buffer;
-                else
-                    data_to_return = this->ppu->read_buffer;
-                
-                //VRAM read/write data register. After access, the video memory address will increment by an amount determined by bit 2 of $2000.
-                //(0: add 1, going across; 1: add 32, going down)
-                if(this->ppu->getPPUCTRL() & 0x04)
-                    this->ppu->vmem_addr += 32;
-                else
-                    this->ppu->vmem_addr += 1;
-                
-                return data_to_return;
-                break;
-            }
-                
-            //not all registers are readable
-            default:
-                return 0x00;
-                break;
-        }
+        if(!this->ppu_access())
+            return 0x00;
+        return this->ppu->read_register(addr);
     }
     else if (addr <= 0x401F){
         switch (addr) {
             case 0x4014:
+                if(!this->ppu_access())
+                    return 0x00;
                 return this->ppu->getOAMDMA();
                 break;
-            case 0x4016:{
-                bool value = ((this->controler_shifter & 0x80) != 0);
-                this->controler_shifter <<= 1;
+            case 0x4016:
+            case 0x4017:{
+                int port = addr & 0x01;
+                if(this->strobe) //the shift register is reloaded, the state of A is always read
+                    this->controler_shifter[port] = this->controller(port, false);
+                bool value = ((this->controler_shifter[port] & 0x80) != 0);
+                this->controler_shifter[port] <<= 1;
                 return value;
                 break;
             }
@@ -202,31 +129,17 @@ Byte NES::read(Address addr){
 }
 
 
+bool NES::ppu_access(){
+    return this->parallel == NULL || this->parallel->access();
+}
+
+
 void NES::clock(){
     ppu->clock();
 
     if(this->cycle % 3 == 0){ //this cycle also concerns the cpu (which runs 3 times slower than the ppu)
-        if(this->transfert_dma){
-            if(this->dma_idle_cycle_done){
-                //read is done on even cycles and write on odd cycles
-                //I'll do both during odd cycles. It won't matter as CPU is disabled
-                if(this->cycle & 0x01){
-                    this->ppu->setOAM_with_addr( this->read((this->ppu->getOAMDMA() << 8) + this->dma_offset), this->dma_offset);
-
-                
-                    if(this->dma_offset == 0xFF){//dma transfert is done
-                        this->transfert_dma = false;
-                        this->dma_idle_cycle_done = false;
-                        this->dma_offset = 0x00;
-                    }
-                    else
-                        this->dma_offset++;
-                }
-            }
-            else if(this->cycle & 0x01)//we start the dma transfert on an even cycle and at least one idle cycle happen
-                dma_idle_cycle_done = true;
-        }
-
+        if(this->transfert_dma)
+            this->dma_cycle();
         else if(this->ppu->asknmi){
             this->cpu->NMI();
             this->ppu->asknmi = false;
@@ -235,50 +148,211 @@ void NES::clock(){
             this->cpu->clock();
     }
     
-    if(ppu->get_cycle() == 0 && ppu->get_scanline() == -1){ //we update the controler state at each frame
-        SDL_Event event;
-        //0 - A
-        //1 - B
-        //2 - Select
-        //3 - Start
-        //4 - Up
-        //5 - Down
-        //6 - Left
-        //7 - Right
-        this->controler_shifter = 0x00;
-        SDL_PollEvent(&event);
-        const Byte *keys = SDL_GetKeyboardState(NULL); //keyboard is handled as qwerty
-        if(keys[SDL_SCANCODE_W]) // z
-            this->controler_shifter |= 0x08;
-        if(keys[SDL_SCANCODE_A]) // q
-            this->controler_shifter |= 0x02;
-        if(keys[SDL_SCANCODE_S])
-            this->controler_shifter |= 0x04;
-        if(keys[SDL_SCANCODE_D])
-            this->controler_shifter |= 0x01;
-        if(keys[SDL_SCANCODE_G])
-            this->controler_shifter |= 0x20;
-        if(keys[SDL_SCANCODE_H])
-            this->controler_shifter |= 0x10;
-        if(keys[SDL_SCANCODE_K])
-            this->controler_shifter |= 0x80;
-        if(keys[SDL_SCANCODE_L])
-            this->controler_shifter |= 0x40;
-
-
-        if(event.type == SDL_QUIT) //we quit if the user tells us to quit
-            exit(0);
-    }
-    
     cycle++;
 }
 
 
+void NES::run_frame(){
+    do
+        this->clock();
+    while(!ppu->is_frame_start());
+}
+
+NES *NES::headless(std::string rom){
+    NES *nes = new NES;
+    nes->ppu = new PPU(nes, NULL); //the frames are rendered in a buffer of the ppu
+    nes->ppu->set_video(false);
+    nes->cartridge->load(rom);
+    return nes;
+}
+
+
+size_t NES::state_size(){
+    return sizeof(SAVESTATE);
+}
+
+size_t NES::save_state(void *buffer, size_t size){
+    if(size < sizeof(SAVESTATE))
+        return 0;
+    std::memset(buffer, 0, sizeof(SAVESTATE)); //the padding too, so that equal states have equal bytes
+    SAVESTATE *state = static_cast<SAVESTATE *>(buffer);
+
+    state->magic = SAVESTATE::MAGIC;
+    state->version = SAVESTATE::VERSION;
+    state->size = sizeof(SAVESTATE);
+    state->rom = cartridge->hash;
+
+    state->nes.cycle = this->cycle;
+    state->nes.transfert_dma = this->transfert_dma;
+    state->nes.dma_offset = this->dma_offset;
+    state->nes.dma_idle_cycle_done = this->dma_idle_cycle_done;
+    state->nes.controler_shifter = this->controler_shifter;
+    state->nes.strobe = this->strobe;
+    state->nes.ram = *this->ram;
+    cpu->save_state(state->cpu);
+    ppu->save_state(state->ppu);
+    return sizeof(SAVESTATE);
+}
+
+std::vector<size_t> NES::state_pages(){
+    const size_t nes = offsetof(SAVESTATE, nes);
+    const size_t ppu = offsetof(SAVESTATE, ppu);
+    const size_t regions[][2] = {
+        {nes + offsetof(NES::State, ram), 2048},
+        {ppu + offsetof(PPU::State, Pattern_table), 0x1000},
+        {ppu + offsetof(PPU::State, Pattern_table) + 0x1000, 0x1000},
+        {ppu + offsetof(PPU::State, Nametable), 0x400},
+        {ppu + offsetof(PPU::State, Nametable) + 0x400, 0x400},
+        {ppu + offsetof(PPU::State, Nametable) + 0x800, 0x400},
+        {ppu + offsetof(PPU::State, Nametable) + 0xC00, 0x400},
+        {ppu + offsetof(PPU::State, Palette), 0x20},
+        {ppu + offsetof(PPU::State, line_background), 3 * 256}, //the 3 line buffers
+        {ppu + offsetof(PPU::State, OAM), 64 * sizeof(Sprite)},
+    };
+
+    std::vector<size_t> pages;
+    pages.push_back(0);
+    for(const size_t *region : regions){
+        pages.push_back(region[0]);
+        pages.push_back(region[0] + region[1]);
+    }
+    pages.push_back(sizeof(SAVESTATE));
+    std::sort(pages.begin(), pages.end());
+    pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+    return pages;
+}
+
+//name, part of the state, type of the part, field, address of the first byte, render pipeline
+#define STATE_FIELD(name, part, type, field, address, pipeline) \
+    {name, offsetof(SAVESTATE, part) + offsetof(type, field), sizeof(((type *) NULL)->field), address, pipeline}
+
+const std::vector<NES::StateField> &NES::state_fields(){
+    static const std::vector<StateField> fields = {
+        STATE_FIELD("cycle", nes, NES::State, cycle, -1, false),
+        STATE_FIELD("DMA transfer", nes, NES::State, transfert_dma, -1, false),
+        STATE_FIELD("DMA offset", nes, NES::State, dma_offset, -1, false),
+        STATE_FIELD("DMA idle cycle done", nes, NES::State, dma_idle_cycle_done, -1, false),
+        STATE_FIELD("controller shift registers", nes, NES::State, controler_shifter, -1, false),
+        STATE_FIELD("controller strobe", nes, NES::State, strobe, -1, false),
+        STATE_FIELD("RAM", nes, NES::State, ram, 0x0000, false),
+
+        STATE_FIELD("cpu A", cpu, CPU::State, r_A, -1, false),
+        STATE_FIELD("cpu X", cpu, CPU::State, r_iX, -1, false),
+        STATE_FIELD("cpu Y", cpu, CPU::State, r_iY, -1, false),
+        STATE_FIELD("cpu SP", cpu, CPU::State, r_SP, -1, false),
+        STATE_FIELD("cpu PC", cpu, CPU::State, r_PC, -1, false),
+        STATE_FIELD("cpu P", cpu, CPU::State, nv_bdizc, -1, false),
+        STATE_FIELD("cpu opcode", cpu, CPU::State, opcode, -1, false),
+        STATE_FIELD("cpu jammed", cpu, CPU::State, jammed, -1, false),
+        STATE_FIELD("cpu data read", cpu, CPU::State, data_to_read, -1, false),
+        STATE_FIELD("cpu additional cycles", cpu, CPU::State, additionnal_cycles, -1, false),
+        STATE_FIELD("cpu remaining cycles", cpu, CPU::State, rem_cycles, -1, false),
+        STATE_FIELD("cpu cycles", cpu, CPU::State, cycles, -1, false),
+
+        STATE_FIELD("ppu dots", ppu, PPU::State, dots, -1, false),
+        STATE_FIELD("ppu scanline", ppu, PPU::State, scanline, -1, false),
+        STATE_FIELD("ppu dot", ppu, PPU::State, cycle, -1, false),
+        STATE_FIELD("ppu odd frame", ppu, PPU::State, odd_frame, -1, false),
+        STATE_FIELD("PPUCTRL", ppu, PPU::State, registers.PPUCTRL, -1, false),
+        STATE_FIELD("PPUMASK", ppu, PPU::State, registers.PPUMASK, -1, false),
+        STATE_FIELD("PPUSTATUS", ppu, PPU::State, registers.PPUSTATUS, -1, false),
+        STATE_FIELD("OAMADDR", ppu, PPU::State, registers.OAMADDR, -1, false),
+        STATE_FIELD("OAMDATA", ppu, PPU::State, registers.OAMDATA, -1, false),
+        STATE_FIELD("PPUSCROLL", ppu, PPU::State, registers.PPUSCROLL, -1, false),
+        STATE_FIELD("PPUADDR", ppu, PPU::State, registers.PPUADDR, -1, false),
+        STATE_FIELD("OAMDMA", ppu, PPU::State, registers.OAMDMA, -1, false),
+        STATE_FIELD("pattern tables", ppu, PPU::State, Pattern_table, 0x0000, false),
+        STATE_FIELD("nametables", ppu, PPU::State, Nametable, 0x2000, false),
+        STATE_FIELD("palette", ppu, PPU::State, Palette, 0x3F00, false),
+        STATE_FIELD("line background pixels", ppu, PPU::State, line_background, -1, true),
+        STATE_FIELD("line sprite pixels", ppu, PPU::State, line_sprites, -1, true),
+        STATE_FIELD("line palette addresses", ppu, PPU::State, line_addresses, -1, true),
+        STATE_FIELD("staged pixels", ppu, PPU::State, staged_pixels, -1, true),
+        STATE_FIELD("composited pixels", ppu, PPU::State, composited_pixels, -1, true),
+        STATE_FIELD("pattern shift register 1", ppu, PPU::State, pattern_data_shift_register_1, -1, true),
+        STATE_FIELD("pattern shift register 2", ppu, PPU::State, pattern_data_shift_register_2, -1, true),
+        STATE_FIELD("palette shift register 1", ppu, PPU::State, palette_attribute_shift_register_1, -1, true),
+        STATE_FIELD("palette shift register 2", ppu, PPU::State, palette_attribute_shift_register_2, -1, true),
+        STATE_FIELD("pattern latch 1", ppu, PPU::State, pattern_data_shift_register_1_latch, -1, true),
+        STATE_FIELD("pattern latch 2", ppu, PPU::State, pattern_data_shift_register_2_latch, -1, true),
+        STATE_FIELD("next tile", ppu, PPU::State, next_pattern_data_shift_register_location, -1, true),
+        STATE_FIELD("palette latch 1", ppu, PPU::State, palette_attribute_shift_register_1_latch, -1, true),
+        STATE_FIELD("palette latch 2", ppu, PPU::State, palette_attribute_shift_register_2_latch, -1, true),
+        STATE_FIELD("OAM", ppu, PPU::State, OAM, -1, false),
+        STATE_FIELD("secondary OAM", ppu, PPU::State, Sec_OAM, -1, false),
+        STATE_FIELD("last available slot", ppu, PPU::State, last_available_slot, -1, false),
+        STATE_FIELD("sprite shift registers", ppu, PPU::State, sprite_shift_registers, -1, true),
+        STATE_FIELD("sprite latches", ppu, PPU::State, sprite_latches, -1, true),
+        STATE_FIELD("sprite counters", ppu, PPU::State, sprite_counters, -1, true),
+        STATE_FIELD("sprite evaluation n", ppu, PPU::State, n, -1, false),
+        STATE_FIELD("sprite cycle", ppu, PPU::State, sprite_cycle, -1, false),
+        STATE_FIELD("sprite data read", ppu, PPU::State, sprite_data_read, -1, false),
+        STATE_FIELD("sprite search done", ppu, PPU::State, sprite_search_is_done, -1, false),
+        STATE_FIELD("number of sprites", ppu, PPU::State, number_of_sprites, -1, false),
+        STATE_FIELD("sprite 0 found", ppu, PPU::State, is_sprite_0_there, -1, false),
+        STATE_FIELD("sprite 0 loaded", ppu, PPU::State, is_sprite_0_loaded, -1, false),
+        STATE_FIELD("ppu v", ppu, PPU::State, vmem_addr, -1, false),
+        STATE_FIELD("ppu t", ppu, PPU::State, addr_t, -1, false),
+        STATE_FIELD("fine x scroll", ppu, PPU::State, fine_x_scroll, -1, false),
+        STATE_FIELD("write toggle", ppu, PPU::State, write_toggle, -1, false),
+        STATE_FIELD("NMI", ppu, PPU::State, asknmi, -1, false),
+        STATE_FIELD("read buffer", ppu, PPU::State, read_buffer, -1, false),
+    };
+    return fields;
+}
+
+#undef STATE_FIELD
+
+bool NES::load_state(const void *buffer, size_t size){
+    if(size < sizeof(SAVESTATE))
+        return false;
+    const SAVESTATE *state = static_cast<const SAVESTATE *>(buffer);
+    if(state->magic != SAVESTATE::MAGIC || state->version != SAVESTATE::VERSION
+       || state->size != sizeof(SAVESTATE) || state->rom != cartridge->hash)
+        return false;
+
+    this->cycle = state->nes.cycle;
+    this->transfert_dma = state->nes.transfert_dma;
+    this->dma_offset = state->nes.dma_offset;
+    this->dma_idle_cycle_done = state->nes.dma_idle_cycle_done;
+    this->controler_shifter = state->nes.controler_shifter;
+    this->strobe = state->nes.strobe;
+    *this->ram = state->nes.ram;
+    cpu->load_state(state->cpu);
+    ppu->load_state(state->ppu);
+    return true;
+}
+
+
+void NES::dma_cycle(){
+    if(this->dma_idle_cycle_done){
+        //read is done on even cycles and write on odd cycles
+        //I'll do both during odd cycles. It won't matter as CPU is disabled
+        if(this->cycle & 0x01){
+            Byte value = this->read((this->ppu->getOAMDMA() << 8) + this->dma_offset);
+            if(this->ppu_access())
+                this->ppu->setOAM_with_addr(value, this->dma_offset);
+
+        
+            if(this->dma_offset == 0xFF){//dma transfert is done
+                this->transfert_dma = false;
+                this->dma_idle_cycle_done = false;
+                this->dma_offset = 0x00;
+            }
+            else
+                this->dma_offset++;
+        }
+    }
+    else if(this->cycle & 0x01)//we start the dma transfert on an even cycle and at least one idle cycle happen
+        dma_idle_cycle_done = true;
+}
+
+
 void NES::debug_loop(bool log, bool sts){
     this->debug = new Debugger(this, cpu, ppu); //we only initialize it when it is requiered
     
     int ppucycle = 0;
-    while(1){
+    while(!input->should_quit()){
         this->clock();
         if(ppucycle %3 == 0){
             //trickery to run instruction by instruction
@@ -305,23 +379,127 @@ void NES::debug_loop(bool log, bool sts){
 }
 
 void NES::usual_loop(){
-    //all of this is meant to keep the ppu to run too fast. A defined number of cycle is used to construct af frame. If the host runs too fast, the game will be unplayable.
-    int currentTime = SDL_GetTicks();
-    int lastFrame = SDL_GetTicks();
-    while(1){
-        currentTime = SDL_GetTicks();
-        if(ppu->get_scanline() == -1 && ppu->get_cycle() == 0){ //we wait during each frame to keep a steedy 60 fps (at a higher framerate, everything is faster)
-            if((float (currentTime - lastFrame)) >= 1./60){
-                lastFrame = currentTime;
-                this->clock();
+    while(!input->should_quit()){
+        this->clock();
+        if(ppu->is_frame_start()){
+            bool video = this->frame_start();
+            if(rewind != NULL && input->is_rewinding()){
+                rewind->step_back(this); //the frame is played again, it is always shown
+                video = true;
             }
+            else if(rewind != NULL)
+                rewind->capture(this);
+            if(movie != NULL)
+                movie->frame_start(this);
+            if(state_hash != NULL)
+                state_hash->frame(this);
+            this->frame_saves();
+            ppu->set_video(video);
         }
-        else
-            this->clock();
     }
 }
 
 
+bool NES::frame_start(){
+    while(input->is_paused() && !input->should_quit())
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    bool fast_forward = input->is_fast_forward();
+    if(!fast_forward)
+        pacer->frame(); //sleeps until the frame is due
+    presenter->count_emulated();
+    return frameskip == NULL || frameskip->next(pacer->is_late(), fast_forward);
+}
+
+
+void NES::frame_saves(){
+    if(session != NULL)
+        session->frame(this);
+    if(input->take_save_request()){
+        if(state_store == NULL)
+            std::cout << "Use --state_store to save states" << std::endl;
+        else{
+            int64_t id = state_store->save(this);
+            if(id < 0)
+                std::cout << "Could not save the state" << std::endl;
+            else
+                std::cout << "State " << id << " saved" << std::endl;
+        }
+    }
+}
+
+
+//Run-ahead: games usually react to the input one or more frames after they read it.
+//At each frame, the real frame is emulated without video and saved, then the emulation goes on with the
+//same input for `frames` more frames and only the last one is shown. The saved state is restored afterwards.
+//What is shown is what the game would show `frames` frames later if the input did not change.
+void NES::runahead_loop(int frames){
+    std::vector<Byte> state(state_size());
+    while(!input->should_quit()){
+        this->frame_start(); //every frame is emulated, the frame skip is ignored
+        if(state_hash != NULL)
+            state_hash->frame(this);
+        this->frame_saves();
+
+        ppu->set_video(false);
+        this->run_frame();
+        this->save_state(state.data(), state.size());
+        for(int i = 1; i < frames; i++)
+            this->run_frame();
+        ppu->set_video(true);
+        this->run_frame();
+        this->load_state(state.data(), state.size());
+    }
+}
+
+
+bool NES::seek(uint64_t frame){
+    if(!movie->seek(frame, this))
+        return false;
+    //from the keyframe to the frame
+    bool video = ppu->get_video();
+    ppu->set_video(false);
+    while(movie->get_frame() < frame){
+        this->clock();
+        if(ppu->is_frame_start())
+            movie->frame_start(this);
+    }
+    ppu->set_video(video);
+    return true;
+}
+
+
+void NES::headless_loop(){
+    ppu->set_video(false); //there is no frame to render in
+    uint64_t first = movie->get_frame(); //after a seek
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while(movie->is_playing()){
+        this->clock();
+        if(ppu->is_frame_start()){
+            movie->frame_start(this);
+            if(state_hash != NULL)
+                state_hash->frame(this);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<Byte> state(state_size());
+    this->save_state(state.data(), state.size());
+    uint64_t hash = STATEHASH::hash(state.data(), state.size());
+    uint64_t frames = movie->get_frames() - first;
+    std::cout << frames << " frames in " << std::fixed << std::setprecision(3) << seconds << " s (" << std::setprecision(1) << frames / seconds << " fps)"
+              << (movie->is_desynchronized() ? ", desynchronized" : "") << ", state hash " << std::hex << std::setw(16) << std::setfill('0') << hash << std::dec << std::endl;
+}
+
+
+void NES::parallel_loop(){
+    this->parallel = new PARALLEL(this);
+    this->parallel->run();
+    delete this->parallel;
+    this->parallel = NULL;
+}
+
+
 int main(int argc, char** argv){
     NES nes;
     
@@ -330,6 +508,44 @@ int main(int argc, char** argv){
         ("help,h", "print the help message")
         ("rom", boost::program_options::value<std::string>(), "set the rom file to open")
         ("screen_size_multiplier,ssm", boost::program_options::value<float>(), "set the screen size multiplier")
+        ("palette", boost::program_options::value<std::string>(), "set the .pal file (64 or 512 colors) to use")
+        ("vsync", "synchronize the presentation with the screen refresh")
+        ("filter", boost::program_options::value<std::string>(), "scale the frames on the cpu: nearest, scale2x, scale3x or ntsc (composite video)")
+        ("aspect", "resample the filtered frames to the 8:7 pixel aspect ratio")
+        ("filter_threads", boost::program_options::value<int>(), "number of threads used by the filter (default: one per core)")
+        ("filter_output", boost::program_options::value<std::string>(), "also write the filtered frames (raw 32 bits ARGB) to this file")
+        ("deferred", "render the frames on an other thread while the next one is emulated")
+        ("pacing", boost::program_options::value<std::string>(), "fixed (60.0988 Hz, default), vsync (follow the screen, default with --vsync) or unthrottled")
+        ("rate", boost::program_options::value<double>(), "frame rate of the fixed pacing (default: 60.0988)")
+        ("frame_delay", boost::program_options::value<std::string>(), "wait after each refresh before emulating the frame so the game reads the input later (vsync pacing only): auto or a number of milliseconds")
+        ("frameskip", boost::program_options::value<std::string>(), "skip the pixels of N frames out of M (N/M, the side effects of the frames are kept) or auto (skip when the host is too slow)")
+        ("runahead", boost::program_options::value<int>(), "emulate this many frames ahead and show the last one to hide the input lag of the game")
+        ("rewind", boost::program_options::value<int>(), "keep this many MiB of save states to play the game backwards (hold backspace)")
+        ("rewind_interval", boost::program_options::value<int>(), "frames between two save states of the rewind (default: 1)")
+        ("session", boost::program_options::value<std::string>(), "save the session in this directory and resume it when the same game is started again")
+        ("session_interval", boost::program_options::value<int>(), "seconds between two saves of the session (default: 10)")
+        ("state_store", boost::program_options::value<std::string>(), "directory of the save state library (F5 saves a state in it)")
+        ("load_state", boost::program_options::value<uint64_t>(), "start from this state of the library instead of booting the game")
+        ("record", boost::program_options::value<std::string>(), "record the input in this movie file")
+        ("play", boost::program_options::value<std::string>(), "play this movie file back (the controllers are live once it is over)")
+        ("keyframes", boost::program_options::value<double>(), "save a keyframe in the recorded movie every this many seconds, to seek in it")
+        ("seek", boost::program_options::value<uint64_t>(), "start the movie played at this frame")
+        ("hash_log", boost::program_options::value<std::string>(), "write the hash of the whole state at each frame to this file (to find where two runs diverge)")
+        ("bisect", boost::program_options::value<std::vector<std::string>>()->multitoken(), "find the first frame, dot and instruction where two configurations (e.g. video,avx2 novideo,scalar, see bisect.hpp) diverge with the movie given by --play")
+        ("search", boost::program_options::value<int>(), "search without window the inputs which maximize --objective for this many steps (see search.hpp), --record writes the best one")
+        ("objective", boost::program_options::value<std::string>(), "score of a state for --search: RAM bytes with weights, e.g. 256*$0075+$0076-$00a0")
+        ("buttons", boost::program_options::value<std::string>(), "buttons of controller 1 tried at each step of --search, hexadecimal values separated by commas (default: 0,1,2,80,40,81,41,c1,82,8,4,10)")
+        ("search_frames", boost::program_options::value<int>(), "frames of each step of --search (default: 8)")
+        ("beam", boost::program_options::value<int>(), "states kept after each step of --search (default: 32)")
+        ("search_threads", boost::program_options::value<int>(), "number of threads of --search (default: one per core)")
+        ("fuzz", boost::program_options::value<uint64_t>(), "play this many mutated inputs without window to find new code and crashes (see fuzzer.hpp), from the movie given by --play or from the power-up")
+        ("fuzz_frames", boost::program_options::value<int>(), "frames of each input of --fuzz (default: 600)")
+        ("fuzz_ram", boost::program_options::value<std::string>(), "RAM regions whose content counts as coverage for --fuzz, e.g. $0300-$03ff,$0040")
+        ("fuzz_output", boost::program_options::value<std::string>(), "directory of the movies of the new inputs and of the crashes found by --fuzz (default: fuzz)")
+        ("fuzz_threads", boost::program_options::value<int>(), "number of threads of --fuzz (default: one per core)")
+        ("headless", "play the movie given by --play as fast as possible without window, then print the speed and the hash of the final state")
+        ("latency_log", boost::program_options::value<std::string>(), "measure the input latency and write it to this file when quitting (.csv or .json)")
+        ("parallel", "run the cpu and the ppu on two threads (prints the synchronization statistics at exit)")
         ("debug,d", "start in debug mode")
         ("log", "enable logging")
         ("step_by_step,sbs", "enable step by step")
@@ -353,11 +569,177 @@ int main(int argc, char** argv){
         return 1;
     }
 
+    if(vm.count("bisect")){
+        std::vector<std::string> configs = vm["bisect"].as<std::vector<std::string>>();
+        BISECT::Config a, b;
+        if(configs.size() != 2 || !BISECT::parse(configs[0], a) || !BISECT::parse(configs[1], b)){
+            std::cout << "--bisect needs two configurations: video or novideo, and scalar, sse2 or avx2, separated by commas" << std::endl;
+            return 1;
+        }
+        if(!vm.count("play") || !vm.count("rom")){
+            std::cout << "--bisect needs --rom and --play" << std::endl;
+            return 1;
+        }
+        BISECT bisect(a, b);
+        if(!bisect.load(vm["rom"].as<std::string>(), vm["play"].as<std::string>()))
+            return 1;
+        return bisect.run();
+    }
+
+    if(vm.count("search")){
+        std::vector<SEARCH::Term> objective;
+        std::vector<Byte> buttons = {0x00, 0x01, 0x02, 0x80, 0x40, 0x81, 0x41, 0xC1, 0x82, 0x08, 0x04, 0x10};
+        if(!vm.count("rom") || !vm.count("objective") || !SEARCH::parse_objective(vm["objective"].as<std::string>(), objective)){
+            std::cout << "--search needs --rom and an --objective like 256*$0075+$0076-$00a0" << std::endl;
+            return 1;
+        }
+        if(vm.count("buttons") && !SEARCH::parse_buttons(vm["buttons"].as<std::string>(), buttons)){
+            std::cout << "--buttons must be hexadecimal values separated by commas" << std::endl;
+            return 1;
+        }
+        int frames = vm.count("search_frames") ? vm["search_frames"].as<int>() : 8;
+        int beam = vm.count("beam") ? vm["beam"].as<int>() : 32;
+        if(frames < 1 || beam < 1){
+            std::cout << "--search_frames and --beam must be positive" << std::endl;
+            return 1;
+        }
+
+        //the search starts from the power-up state or from a state of the library
+        nes.ppu = new PPU(&nes, NULL);
+        nes.cartridge->load(vm["rom"].as<std::string>());
+        if(vm.count("load_state")){
+            nes.state_store = vm.count("state_store") ? new STATESTORE(vm["state_store"].as<std::string>()) : NULL;
+            if(nes.state_store == NULL || !nes.state_store->is_open() || !nes.state_store->load(&nes, vm["load_state"].as<uint64_t>())){
+                std::cout << "--load_state needs a state of this game in the library given by --state_store" << std::endl;
+                return 1;
+            }
+        }
+        else
+            nes.cpu->reset();
+        std::vector<Byte> start(NES::state_size());
+        nes.save_state(start.data(), start.size());
+
+        int threads = vm.count("search_threads") ? vm["search_threads"].as<int>() : (int) std::thread::hardware_concurrency();
+        SEARCH search(vm["rom"].as<std::string>(), start, objective, threads);
+        search.run(vm["search"].as<int>(), frames, (size_t) beam, buttons);
+        if(vm.count("record") && !search.write_movie(vm["record"].as<std::string>()))
+            return 1;
+        return 0;
+    }
+
+    if(vm.count("fuzz")){
+        std::vector<FUZZER::Region> ram;
+        if(!vm.count("rom")){
+            std::cout << "--fuzz needs --rom" << std::endl;
+            return 1;
+        }
+        if(vm.count("fuzz_ram") && !FUZZER::parse_regions(vm["fuzz_ram"].as<std::string>(), ram)){
+            std::cout << "--fuzz_ram must be RAM regions like $0300-$03ff separated by commas" << std::endl;
+            return 1;
+        }
+        int frames = vm.count("fuzz_frames") ? vm["fuzz_frames"].as<int>() : 600;
+        if(frames < 1){
+            std::cout << "--fuzz_frames must be positive" << std::endl;
+            return 1;
+        }
+
+        //the inputs start from the state of the movie (which is also a seed) or from the power-up state
+        nes.ppu = new PPU(&nes, NULL);
+        nes.cartridge->load(vm["rom"].as<std::string>());
+        std::vector<Byte> seed;
+        if(vm.count("play")){
+            nes.movie = MOVIE::play(vm["play"].as<std::string>(), &nes);
+            if(nes.movie == NULL)
+                return 1;
+            for(uint64_t frame = 0; frame < nes.movie->get_frames(); frame++)
+                seed.push_back(nes.movie->get_buttons(frame));
+        }
+        else
+            nes.cpu->reset();
+        std::vector<Byte> start(NES::state_size());
+        nes.save_state(start.data(), start.size());
+
+        int threads = vm.count("fuzz_threads") ? vm["fuzz_threads"].as<int>() : (int) std::thread::hardware_concurrency();
+        FUZZER fuzzer(vm["rom"].as<std::string>(), start, ram, threads);
+        if(!seed.empty())
+            fuzzer.add_seed(seed);
+        return fuzzer.run(vm["fuzz"].as<uint64_t>(), frames, vm.count("fuzz_output") ? vm["fuzz_output"].as<std::string>() : "fuzz") != 0;
+    }
+
+    if(vm.count("headless")){
+        if(!vm.count("play") || !vm.count("rom")){
+            std::cout << "--headless needs --rom and --play" << std::endl;
+            return 1;
+        }
+        nes.ppu = new PPU(&nes, NULL);
+        nes.cartridge->load(vm["rom"].as<std::string>());
+        nes.movie = MOVIE::play(vm["play"].as<std::string>(), &nes);
+        if(nes.movie == NULL)
+            return 1;
+        if(vm.count("hash_log")){
+            nes.state_hash = new STATEHASH(vm["hash_log"].as<std::string>());
+            if(!nes.state_hash->is_open()){
+                std::cout << "Could not write the hash log " << vm["hash_log"].as<std::string>() << std::endl;
+                return 1;
+            }
+        }
+        if(vm.count("seek")){
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if(!nes.seek(vm["seek"].as<uint64_t>())){
+                if(vm["seek"].as<uint64_t>() > nes.movie->get_frames())
+                    std::cout << "The movie has only " << nes.movie->get_frames() << " frames" << std::endl;
+                return 1;
+            }
+            std::cout << "seek to frame " << vm["seek"].as<uint64_t>() << " in " << std::fixed << std::setprecision(3)
+                      << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+        }
+        nes.headless_loop();
+        delete nes.state_hash; //flushes the log
+        return nes.movie->is_desynchronized() ? 2 : 0;
+    }
+
+    bool vsync = vm.count("vsync") != 0;
+    PRESENTER *presenter;
     if(vm.count("screen_size_multiplier")){ //this must be evaluated first as it initialize the ppu 
-        nes.ppu = new PPU(&nes, vm["screen_size_multiplier"].as<float>());
+        presenter = new PRESENTER(vm["screen_size_multiplier"].as<float>(), vsync);
     }
     else{
-        nes.ppu = new PPU(&nes, 3);
+        presenter = new PRESENTER(3, vsync);
+    }
+    nes.ppu = new PPU(&nes, presenter);
+    nes.presenter = presenter;
+    presenter->set_input(nes.input);
+    if(vm.count("latency_log")){
+        nes.latency = new LATENCY(vm["latency_log"].as<std::string>());
+        nes.input->set_latency(nes.latency);
+        presenter->set_latency(nes.latency);
+    }
+    
+    if(vm.count("palette")){
+        presenter->load_palette(vm["palette"].as<std::string>());
+    }
+    
+    if(vm.count("filter")){
+        std::string name = vm["filter"].as<std::string>();
+        FILTER::Scaler scaler = FILTER::NEAREST;
+        if(name == "scale2x")
+            scaler = FILTER::SCALE2X;
+        else if(name == "scale3x")
+            scaler = FILTER::SCALE3X;
+        else if(name == "ntsc")
+            scaler = FILTER::NTSC_COMPOSITE;
+        else if(name != "nearest"){
+            std::cout << "Unknown filter: " << name << std::endl;
+            std::cout << desc << std::endl;
+            return 1;
+        }
+
+        int factor = vm.count("screen_size_multiplier") ? (int) (vm["screen_size_multiplier"].as<float>() + 0.5) : 3;
+        int threads = vm.count("filter_threads") ? vm["filter_threads"].as<int>() : (int) std::thread::hardware_concurrency();
+        FILTER *filter = new FILTER(scaler, factor, vm.count("aspect") != 0, threads);
+        if(vm.count("filter_output"))
+            filter->set_sink(vm["filter_output"].as<std::string>());
+        presenter->set_filter(filter);
     }
     
     if(vm.count("rom")){
@@ -368,17 +750,158 @@ int main(int argc, char** argv){
         return 0;
     }
 
-    nes.cpu->reset(); //this initialize the cpu in the right state
+    if(vm.count("frameskip")){
+        std::string skip = vm["frameskip"].as<std::string>();
+        if(skip == "auto")
+            nes.frameskip = FRAMESKIP::automatic_skip();
+        else{
+            int n = 0, m = 0;
+            if(std::sscanf(skip.c_str(), "%d/%d", &n, &m) != 2 || n < 0 || m <= n){
+                std::cout << "--frameskip must be auto or N/M with N < M" << std::endl;
+                return 1;
+            }
+            nes.frameskip = new FRAMESKIP(n, m);
+        }
+    }
+    else
+        nes.frameskip = new FRAMESKIP(0, 1); //every frame is rendered, but while fast forwarding
+
+    if(vm.count("runahead") && (vm.count("deferred") || vm.count("parallel") || vm.count("debug"))){
+        std::cout << "--runahead can not be used with --deferred, --parallel or --debug" << std::endl;
+        return 1;
+    }
+
+    if(vm.count("rewind") && (vm.count("runahead") || vm.count("deferred") || vm.count("parallel") || vm.count("debug"))){
+        std::cout << "--rewind can not be used with --runahead, --deferred, --parallel or --debug" << std::endl;
+        return 1;
+    }
+    if(vm.count("rewind") && vm["rewind"].as<int>() > 0)
+        nes.rewind = new REWIND((size_t) vm["rewind"].as<int>() << 20, vm.count("rewind_interval") ? vm["rewind_interval"].as<int>() : 1);
+
+    if(vm.count("deferred")){ //after the rom is loaded: the renderer copies the pattern tables
+        nes.ppu->set_deferred(new DEFERRED(&nes, nes.ppu, presenter));
+    }
+
+    PACER::Mode pacing = vsync ? PACER::VSYNC : PACER::FIXED;
+    if(vm.count("pacing")){
+        std::string name = vm["pacing"].as<std::string>();
+        if(name == "fixed")
+            pacing = PACER::FIXED;
+        else if(name == "vsync")
+            pacing = PACER::VSYNC;
+        else if(name == "unthrottled")
+            pacing = PACER::UNTHROTTLED;
+        else{
+            std::cout << "Unknown pacing: " << name << std::endl;
+            std::cout << desc << std::endl;
+            return 1;
+        }
+    }
+    nes.pacer = new PACER(pacing, presenter, vm.count("rate") ? vm["rate"].as<double>() : PACER::NTSC_RATE);
+    if(vm.count("frame_delay") && pacing != PACER::VSYNC)
+        std::cout << "--frame_delay only works with the vsync pacing, it is ignored" << std::endl;
+    else if(vm.count("frame_delay")){
+        std::string delay = vm["frame_delay"].as<std::string>();
+        if(delay == "auto")
+            nes.pacer->set_auto_delay();
+        else
+            nes.pacer->set_delay(std::chrono::microseconds((long long) (std::atof(delay.c_str()) * 1000)));
+    }
+
+    if((vm.count("record") || vm.count("play"))
+       && (vm.count("runahead") || vm.count("rewind") || vm.count("deferred") || vm.count("parallel") || vm.count("debug"))){
+        std::cout << "--record and --play can not be used with --runahead, --rewind, --deferred, --parallel or --debug" << std::endl;
+        return 1;
+    }
+    if(vm.count("record") && vm.count("play")){
+        std::cout << "--record and --play can not be used together" << std::endl;
+        return 1;
+    }
+    if((vm.count("session") || vm.count("load_state")) && (vm.count("deferred") || vm.count("parallel") || vm.count("debug"))){
+        std::cout << "--session and --load_state can not be used with --deferred, --parallel or --debug" << std::endl;
+        return 1;
+    }
+    if(vm.count("session")){
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.session", (unsigned long long) nes.cartridge->hash);
+        int interval = vm.count("session_interval") ? vm["session_interval"].as<int>() : 10;
+        nes.session = new SESSION(vm["session"].as<std::string>() + name, std::chrono::seconds(interval));
+    }
+
+    if(vm.count("state_store")){
+        nes.state_store = new STATESTORE(vm["state_store"].as<std::string>());
+        if(!nes.state_store->is_open())
+            return 1;
+    }
+
+    if(vm.count("load_state")){
+        if(nes.state_store == NULL || !nes.state_store->load(&nes, vm["load_state"].as<uint64_t>())){
+            std::cout << "--load_state needs a state of this game in the library given by --state_store" << std::endl;
+            return 1;
+        }
+    }
+    else if(nes.session != NULL && nes.session->resume(&nes))
+        std::cout << "Session resumed" << std::endl;
+    else
+        nes.cpu->reset(); //this initialize the cpu in the right state
+    if(nes.session != NULL)
+        nes.session->start();
+
+    if(vm.count("record")){
+        uint64_t keyframes = vm.count("keyframes") ? (uint64_t) (vm["keyframes"].as<double>() * PACER::NTSC_RATE + 0.5) : 0;
+        nes.movie = MOVIE::record(vm["record"].as<std::string>(), &nes, keyframes);
+    }
+    else if(vm.count("play")){
+        nes.movie = MOVIE::play(vm["play"].as<std::string>(), &nes);
+        if(nes.movie == NULL)
+            return 1;
+        if(vm.count("seek") && !nes.seek(vm["seek"].as<uint64_t>())){
+            if(vm["seek"].as<uint64_t>() > nes.movie->get_frames())
+                std::cout << "The movie has only " << nes.movie->get_frames() << " frames" << std::endl;
+            return 1;
+        }
+    }
+
+    if(vm.count("hash_log")){
+        if(vm.count("parallel") || vm.count("debug")){
+            std::cout << "--hash_log can not be used with --parallel or --debug" << std::endl;
+            return 1;
+        }
+        nes.state_hash = new STATEHASH(vm["hash_log"].as<std::string>());
+        if(!nes.state_hash->is_open()){
+            std::cout << "Could not write the hash log " << vm["hash_log"].as<std::string>() << std::endl;
+            return 1;
+        }
+    }
     
+    //the emulation runs on its own thread, the main thread shows the frames (see presenter.hpp)
+    std::thread emulation;
     if(vm.count("debug")){
         bool log = !(vm.count("log") == 0);
         bool sts = !(vm.count("step_by_step") == 0);
 
-        nes.debug_loop(log,sts);
+        emulation = std::thread(&NES::debug_loop, &nes, log, sts);
+    }
+    else if(vm.count("runahead") && vm["runahead"].as<int>() > 0){
+        emulation = std::thread(&NES::runahead_loop, &nes, vm["runahead"].as<int>());
+    }
+    else if(vm.count("parallel")){
+        emulation = std::thread(&NES::parallel_loop, &nes);
     }
     else{
-        nes.usual_loop();
+        emulation = std::thread(&NES::usual_loop, &nes);
     }
 
+    presenter->run(); //returns once the user quits
+    emulation.join(); //the emulation stops on the same command
+    if(nes.movie != NULL && nes.movie->is_recording())
+        nes.movie->write();
+    if(nes.session != NULL){
+        nes.session->close(&nes);
+        delete nes.session;
+    }
+    if(nes.latency != NULL)
+        nes.latency->write();
+    delete nes.state_hash;
     return 0;
 }
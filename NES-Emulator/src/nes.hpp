@@ -10,29 +10,71 @@
 
 
 #include <array>
+#include <vector>
 
 #include "cpu.hpp"
 #include "ppu.hpp"
 #include "cartridge.hpp"
 #include "debug.hpp"
+#include "pacer.hpp"
+#include "input.hpp"
+#include "frameskip.hpp"
+#include "rewind.hpp"
+#include "session.hpp"
+#include "statestore.hpp"
+#include "movie.hpp"
+#include "statehash.hpp"
 
 typedef uint8_t Byte;
 typedef uint16_t Address;
 
 
+class PARALLEL;
+
+
 class NES{
+    friend class PARALLEL;
 private:
-    int cycle; //it will be used to make the cpu run at a third of ppu speed
+    int cycle = 0; //it will be used to make the cpu run at a third of ppu speed
     
     Debugger *debug;
     
     bool transfert_dma = false;
     Byte dma_offset = 0x00;
     bool dma_idle_cycle_done = false;
+    
+    PARALLEL *parallel = NULL; //set when the cpu and the ppu run on their own threads
+    bool ppu_access(); //called before the cpu touches the ppu, false if the access must not happen
+    
+    void dma_cycle();
+    Byte controller(int port, bool latch); //from the keyboard or the movie
+    
+    //save states (see SAVESTATE)
+    struct State{
+        int32_t cycle;
+        bool transfert_dma;
+        Byte dma_offset;
+        bool dma_idle_cycle_done;
+        std::array<Byte, 2> controler_shifter;
+        bool strobe;
+        std::array<Byte, 2048> ram;
+    };
+    struct SAVESTATE;
+    bool frame_start(); //pause, pacing and frame skip, returns true if the frame must be rendered
+    void frame_saves(); //session and save states asked by the user, when a frame starts
 public:
     CPU *cpu;
     PPU *ppu;
     CARTRIDGE *cartridge;
+    PACER *pacer = NULL;
+    FRAMESKIP *frameskip = NULL; //every frame is rendered without it
+    PRESENTER *presenter = NULL;
+    LATENCY *latency = NULL; //input latency measures (--latency_log)
+    REWIND *rewind = NULL;
+    SESSION *session = NULL; //saved in the background, resumed at the next start (--session)
+    STATESTORE *state_store = NULL; //F5 saves the state in it (--state_store)
+    MOVIE *movie = NULL; //recorded or played (--record, --play)
+    STATEHASH *state_hash = NULL; //hash of the state at each frame (--hash_log)
     
     /*
         Constructor
@@ -40,18 +82,67 @@ public:
     NES();
     
     
-    //controller (only one because it's annoying to map two controllers to one keyboard)
-    Byte controler_shifter = 0x00;
+    //controllers ($4016 and $4017)
+    INPUT *input = new INPUT; //updated by the presenter
+    std::array<Byte, 2> controler_shifter = {{0x00, 0x00}};
+    bool strobe = false; //last bit written to $4016
     
-    std::array<Byte, 2048> *ram = new std::array<Byte, 2048>; //the power-up state doesn't matter so the array doesn't have to be initialized
+    std::array<Byte, 2048> *ram = new std::array<Byte, 2048>(); //cleared: the power-up state must be the same at each run (movies)
     
     void write(Address adr, Byte content);
     Byte read(Address adr);
     
     void clock();
+    void run_frame(); //until the next frame starts
+    //without presenter nor video, for the tools which run many instances and only load, play and save states (see SEARCH)
+    static NES *headless(std::string rom);
+    bool instruction_starts(){ return cycle % 3 == 0 && !transfert_dma && !ppu->asknmi && cpu->get_rem_cycles() == 0; } //at the next clock
+    
+    //save states, in a buffer given by the caller (at least state_size() bytes)
+    static size_t state_size();
+    size_t save_state(void *buffer, size_t size); //returns the number of bytes written, 0 if the buffer is too small
+    bool load_state(const void *buffer, size_t size); //false (and nothing changes) if it is not a state of this version and of this game
+    //offsets of the parts of a save state which change independently (RAM, each nametable, palette, OAM...),
+    //from 0 to state_size(): the registers are in the parts between them
+    static std::vector<size_t> state_pages();
+    //what is where in a save state
+    struct StateField{
+        const char *name;
+        size_t offset;   //in the save state
+        size_t size;
+        int address;     //of the first byte in the memory of the cpu (RAM) or of the ppu, -1 if it is not memory
+        bool pipeline;   //render pipeline of the ppu: its content depends on the video mode during a frame (see PPU::save_state)
+    };
+    static const std::vector<StateField> &state_fields();
     
     void debug_loop(bool log, bool sts);
     void usual_loop();
+    void parallel_loop();
+    void runahead_loop(int frames);
+    void headless_loop(); //plays the movie without window nor pacing
+    bool seek(uint64_t frame); //in the movie being played, false if it is shorter
+};
+
+
+//A save state is a single block of plain data: it is saved and restored with a few copies, without going
+//through each field. It holds everything that changes while the machine runs, the cartridge has nothing to save
+//(mapper 0 has no registers, the prg RAM is not mapped and the CHR RAM is the pattern tables of the PPU).
+//The frame being rendered is not part of it (the emulation is the same without it) nor is the log of the deferred renderer.
+//
+//The version must be increased whenever the layout changes (a field of CPU::State, PPU::State or NES::State is
+//added, removed or changes type): states of an other version are refused. The states are only meant to be read
+//by the same build on the same kind of machine (they are not portable across endianness or compilers).
+struct NES::SAVESTATE{
+    static const uint32_t MAGIC = 0x5353454e; //"NESS"
+    static const uint32_t VERSION = 3;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;   //sizeof(SAVESTATE)
+    uint64_t rom;    //CARTRIDGE::hash
+    NES::State nes;
+    CPU::State cpu;
+    PPU::State ppu;
 };
 
 
@@ -0,0 +1,169 @@
+//
+//  ntsc.cpp
+//  NES-Emulator
+//
+
+#include <cmath>
+
+#include "ntsc.hpp"
+
+//every x86-64 cpu has SSE2. Other cpus use the plain versions of the kernels
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+//https://wiki.nesdev.org/w/index.php?title=NTSC_video#Terminated_measurement
+static const float signal_levels[16] = {
+    0.228f, 0.312f, 0.552f, 0.880f, //low, not emphasized
+    0.616f, 0.840f, 1.100f, 1.100f, //high, not emphasized
+    0.192f, 0.256f, 0.448f, 0.712f, //low, emphasized
+    0.500f, 0.676f, 0.896f, 0.896f  //high, emphasized
+};
+static const float black = 0.312f, white = 1.100f;
+
+static bool in_color_phase(int color, int phase){
+    return (color + phase) % 12 < 6;
+}
+
+NTSC::NTSC(){
+    for(int pixel = 0; pixel < 512; pixel++){
+        int color = pixel & 0x0F;
+        int level = (pixel >> 4) & 0x03;
+        int emphasis = pixel >> 6;
+        if(color > 13) //columns $E and $F are black
+            level = 1;
+
+        for(int phase = 0; phase < 12; phase++){
+            //each emphasis bit attenuates the signal during half of the subcarrier (6 of its 12 phases)
+            bool attenuated = ((emphasis & 0x01) && in_color_phase(0x0C, phase))
+                           || ((emphasis & 0x02) && in_color_phase(0x04, phase))
+                           || ((emphasis & 0x04) && in_color_phase(0x08, phase));
+            float low = signal_levels[level + (attenuated ? 8 : 0)];
+            float high = signal_levels[4 + level + (attenuated ? 8 : 0)];
+            if(color == 0) //greys are not modulated
+                low = high;
+            if(color > 12)
+                high = low;
+
+            float signal = in_color_phase(color, phase) ? high : low;
+            (*levels)[pixel][phase] = (signal - black) / (white - black);
+        }
+        for(int phase = 12; phase < 20; phase++)
+            (*levels)[pixel][phase] = (*levels)[pixel][phase - 12];
+    }
+
+    //the hue offset is the one that gives the usual colors ($16 red, $1A green, $12 blue)
+    const double pi = std::acos(-1.);
+    for(int i = 0; i < 12 + SAMPLES + 2 * PADDING + 12; i++){
+        cosine.push_back((float) std::cos(pi * (i % 12 + 3.9) / 6));
+        sine.push_back((float) std::sin(pi * (i % 12 + 3.9) / 6));
+    }
+
+    for(int x = 0; x < WIDTH; x++)
+        (*centers)[x] = (x * SAMPLES + SAMPLES / 2) / WIDTH;
+}
+
+
+void NTSC::render(const Frame &frame, int frame_number, int first, int last, uint32_t *out){
+    //a line lasts 341 * 8 samples so the phase moves by 4 each line.
+    //The skipped dot of odd frames also moves it by 4 between two frames.
+    for(int y = first; y < last; y++)
+        render_line(&frame[y * 256], (4 * y + 4 * (frame_number & 1)) % 12, out + y * WIDTH);
+}
+
+void NTSC::render_line(const Pixel *line, int phase, uint32_t *out){
+    //the signal (and its products with the subcarrier), with black before and after the line
+    alignas(16) float signal[SAMPLES + 2 * PADDING];
+    alignas(16) float in_phase[SAMPLES + 2 * PADDING];
+    alignas(16) float quadrature[SAMPLES + 2 * PADDING];
+    for(int i = 0; i < PADDING; i++){
+        signal[i] = signal[PADDING + SAMPLES + i] = 0;
+    }
+
+    //cosine[subcarrier + i] is the subcarrier at sample i of the padded signal
+    const float *cosine = this->cosine.data() + phase + 12 - PADDING;
+    const float *sine = this->sine.data() + phase + 12 - PADDING;
+
+    int x = 0;
+#if defined(__SSE2__)
+    for(; x < 256; x++){
+        const float *levels = &(*this->levels)[line[x] & 0x01FF][(phase + 8 * x) % 12];
+        _mm_store_ps(signal + PADDING + 8 * x, _mm_loadu_ps(levels));
+        _mm_store_ps(signal + PADDING + 8 * x + 4, _mm_loadu_ps(levels + 4));
+    }
+    for(int i = 0; i < SAMPLES + 2 * PADDING; i += 4){
+        __m128 s = _mm_load_ps(signal + i);
+        _mm_store_ps(in_phase + i, _mm_mul_ps(s, _mm_loadu_ps(cosine + i)));
+        _mm_store_ps(quadrature + i, _mm_mul_ps(s, _mm_loadu_ps(sine + i)));
+    }
+#else
+    for(; x < 256; x++){
+        const float *levels = &(*this->levels)[line[x] & 0x01FF][(phase + 8 * x) % 12];
+        for(int i = 0; i < 8; i++)
+            signal[PADDING + 8 * x + i] = levels[i];
+    }
+    for(int i = 0; i < SAMPLES + 2 * PADDING; i++){
+        in_phase[i] = signal[i] * cosine[i];
+        quadrature[i] = signal[i] * sine[i];
+    }
+#endif
+
+    //the TV averages the signal over a whole period of the subcarrier around each output pixel.
+    //The sums are done in the same order by both versions so that they give the same image.
+    x = 0;
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 full = _mm_set1_ps(255.f);
+    for(; x + 4 <= WIDTH; x += 4){
+        alignas(16) float yiq[3][4];
+        for(int i = 0; i < 4; i++){
+            int start = (*centers)[x + i] - 6 + PADDING;
+            const float *windows[3] = {signal + start, in_phase + start, quadrature + start};
+            for(int j = 0; j < 3; j++){
+                __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(windows[j]), _mm_loadu_ps(windows[j] + 4)), _mm_loadu_ps(windows[j] + 8));
+                sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));                         //(0 + 2), (1 + 3)
+                sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1))); //(0 + 2) + (1 + 3)
+                _mm_store_ss(&yiq[j][i], sum);
+            }
+        }
+        __m128 Y = _mm_mul_ps(_mm_load_ps(yiq[0]), _mm_set1_ps(1.f / 12));
+        __m128 I = _mm_mul_ps(_mm_load_ps(yiq[1]), _mm_set1_ps(1.f / 6));
+        __m128 Q = _mm_mul_ps(_mm_load_ps(yiq[2]), _mm_set1_ps(1.f / 6));
+
+        __m128 R = _mm_add_ps(_mm_add_ps(Y, _mm_mul_ps(I, _mm_set1_ps(0.946882f))), _mm_mul_ps(Q, _mm_set1_ps(0.623557f)));
+        __m128 G = _mm_sub_ps(_mm_sub_ps(Y, _mm_mul_ps(I, _mm_set1_ps(0.274788f))), _mm_mul_ps(Q, _mm_set1_ps(0.635691f)));
+        __m128 B = _mm_add_ps(_mm_sub_ps(Y, _mm_mul_ps(I, _mm_set1_ps(1.108545f))), _mm_mul_ps(Q, _mm_set1_ps(1.709007f)));
+
+        __m128i r = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(R, full), zero), full));
+        __m128i g = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(G, full), zero), full));
+        __m128i b = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(B, full), zero), full));
+        __m128i argb = _mm_or_si128(_mm_or_si128(_mm_set1_epi32((int) 0xFF000000), _mm_slli_epi32(r, 16)), _mm_or_si128(_mm_slli_epi32(g, 8), b));
+        _mm_storeu_si128((__m128i *) (out + x), argb);
+    }
+#endif
+    for(; x < WIDTH; x++){
+        int start = (*centers)[x] - 6 + PADDING;
+        const float *windows[3] = {signal + start, in_phase + start, quadrature + start};
+        float yiq[3];
+        for(int j = 0; j < 3; j++){
+            float lanes[4];
+            for(int i = 0; i < 4; i++)
+                lanes[i] = (windows[j][i] + windows[j][i + 4]) + windows[j][i + 8];
+            yiq[j] = (lanes[0] + lanes[2]) + (lanes[1] + lanes[3]);
+        }
+        float Y = yiq[0] * (1.f / 12), I = yiq[1] * (1.f / 6), Q = yiq[2] * (1.f / 6);
+
+        float rgb[3] = {
+            (Y + I * 0.946882f) + Q * 0.623557f,
+            (Y - I * 0.274788f) - Q * 0.635691f,
+            (Y - I * 1.108545f) + Q * 1.709007f
+        };
+        uint32_t pixel = 0xFF000000;
+        for(int j = 0; j < 3; j++){
+            float value = std::fmin(std::fmax(rgb[j] * 255.f, 0.f), 255.f);
+            pixel |= (uint32_t) value << (16 - 8 * j);
+        }
+        out[x] = pixel;
+    }
+}
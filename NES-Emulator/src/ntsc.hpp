@@ -0,0 +1,49 @@
+//
+//  ntsc.hpp
+//  NES-Emulator
+//
+
+#ifndef ntsc_hpp
+#define ntsc_hpp
+
+#include <array>
+#include <vector>
+
+#include "screen.hpp"
+
+
+//The NES does not output RGB colors but a composite NTSC signal.
+//This filter generates that signal from the palette indexes (and the emphasis bits) and decodes it
+//the way a TV would, which gives the artifact colors and the dot crawl.
+//https://wiki.nesdev.org/w/index.php?title=NTSC_video
+//
+//Each pixel lasts 8 samples and the color subcarrier lasts 12 samples.
+//The 256 pixels of a line (2048 samples) are decoded to 602 output pixels.
+class NTSC{
+public:
+    static const int WIDTH = 602;
+
+    NTSC();
+
+    //decode lines first to last - 1 of the frame in out (WIDTH * 240 ARGB pixels)
+    //the frame number is used for the phase of the subcarrier which changes each frame (dot crawl)
+    void render(const Frame &, int frame_number, int first, int last, uint32_t *out);
+
+private:
+    static const int SAMPLES = 256 * 8;
+    static const int PADDING = 8; //the decoding window goes 6 samples before and after the line
+
+    //normalized signal level of each pixel for each phase of the subcarrier
+    //20 phases are stored (0 ~ 11 then 0 ~ 7 again) so that the 8 samples of a pixel are always contiguous
+    std::array<std::array<float, 20>, 512> *levels = new std::array<std::array<float, 20>, 512>;
+
+    //cosine and sine of the subcarrier for each phase, repeated to cover a whole line
+    std::vector<float> cosine, sine;
+
+    //center of the decoding window of each output pixel
+    std::array<int, WIDTH> *centers = new std::array<int, WIDTH>;
+
+    void render_line(const Pixel *line, int phase, uint32_t *out);
+};
+
+#endif /* ntsc_hpp */
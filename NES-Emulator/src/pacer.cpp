@@ -0,0 +1,98 @@
+//
+//  pacer.cpp
+//  NES-Emulator
+//
+
+#include <thread>
+#include <algorithm>
+
+#include "pacer.hpp"
+
+
+constexpr double PACER::NTSC_RATE;
+constexpr double PACER::MAX_SPEED;
+constexpr std::chrono::microseconds PACER::SPIN;
+constexpr std::chrono::microseconds PACER::MARGIN;
+const int PACER::MAX_LATE;
+
+
+PACER::PACER(Mode mode, PRESENTER *presenter, double rate){
+    this->mode = mode;
+    this->presenter = presenter;
+    this->period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1. / rate));
+    this->start = Clock::now();
+    this->last = this->start;
+    this->started = this->start;
+}
+
+
+void PACER::set_delay(std::chrono::microseconds delay){
+    this->delay = std::min<Clock::duration>(delay, period);
+    this->auto_delay = false;
+}
+
+void PACER::set_auto_delay(){
+    this->auto_delay = true;
+}
+
+
+
+void PACER::wait_until(Clock::time_point deadline){
+    Clock::time_point now = Clock::now();
+    if(deadline - now > SPIN)
+        std::this_thread::sleep_until(deadline - SPIN);
+    while(Clock::now() < deadline)
+        std::this_thread::yield();
+}
+
+
+void PACER::measure(Clock::time_point now){
+    durations[next] = now - started;
+    next = (next + 1) % WINDOW;
+    if(measured < WINDOW)
+        measured++;
+
+    Clock::duration slowest = Clock::duration::zero();
+    for(int i = 0; i < measured; i++)
+        slowest = std::max(slowest, durations[i]);
+    delay = std::max(Clock::duration::zero(), period - slowest - MARGIN);
+}
+
+
+void PACER::frame(){
+    Clock::time_point now = Clock::now();
+    if(auto_delay)
+        measure(now);
+
+    switch(mode){
+        case UNTHROTTLED:
+            late = false;
+            return;
+
+        case VSYNC:{
+            late = now - last > period + delay;
+            //the presenter takes a frame at each refresh of the screen
+            presenter->wait_taken(Clock::now() + 2 * period);
+            Clock::time_point earliest = last + std::chrono::duration_cast<Clock::duration>(period / MAX_SPEED);
+            wait_until(earliest);
+            last = Clock::now();
+            wait_until(last + delay); //the screen shows the frame at the next refresh
+            break;
+        }
+
+        case FIXED:{
+            frames++;
+            Clock::time_point deadline = start + frames * period;
+            late = now > deadline;
+            if(now > deadline + MAX_LATE * period){ //we can not catch up, the next frame is due in one period
+                start = Clock::now();
+                frames = 0;
+                deadline = start;
+            }
+            wait_until(deadline);
+            last = deadline;
+            break;
+        }
+    }
+    started = Clock::now();
+}
@@ -0,0 +1,82 @@
+//
+//  pacer.hpp
+//  NES-Emulator
+//
+
+#ifndef pacer_hpp
+#define pacer_hpp
+
+#include <chrono>
+#include <cstdint>
+#include <array>
+
+#include "presenter.hpp"
+
+
+//Keeps the emulation at the speed of the real console.
+//It is called at the start of each frame and sleeps until the frame is due.
+//
+//The deadlines are computed from the time the emulation started (frame n is due at start + n * period),
+//so the error of each sleep never adds up. If the emulation is too late (slow host, debugger, the window
+//being dragged), it starts a new schedule instead of running as fast as possible to catch up.
+//
+//modes:
+//  FIXED:       60.0988 Hz (NTSC), or the given rate
+//  VSYNC:       waits for the presenter to take the previous frame, so the emulation follows the refresh
+//               rate of the screen (use it with --vsync). It is never faster than MAX_SPEED times the rate
+//               so that a 120 Hz or 144 Hz screen does not run the games too fast
+//  UNTHROTTLED: as fast as possible (benchmarks)
+//
+//Frame delay (VSYNC only): games read the controller early in the frame, and the frame is shown at the next refresh.
+//Waiting a bit after the refresh before starting the frame makes the game read the input later, so it shows up sooner.
+//In FIXED mode the frames are not shown at the deadlines but at the refreshes, a delay would only shift the schedule.
+//The automatic delay measures how long the last WINDOW frames took to emulate and starts the frame
+//as late as the slowest of them allows (minus MARGIN). A slow frame shortens the delay at once,
+//the delay only grows back once that frame leaves the window.
+class PACER{
+public:
+    enum Mode { FIXED, VSYNC, UNTHROTTLED };
+    static constexpr double NTSC_RATE = 60.0988;  //21.477272 MHz / 4 / (341 * 262 - 0.5) dots per frame
+
+    PACER(Mode, PRESENTER *, double rate = NTSC_RATE);
+
+    void frame(); //a new frame starts, returns when it is due
+    bool is_late(){ return late; } //the last frame started after its deadline (the host is too slow)
+
+    void set_delay(std::chrono::microseconds); //fixed frame delay
+    void set_auto_delay();
+
+    Mode get_mode(){ return mode; }
+    std::chrono::steady_clock::duration get_period(){ return period; }
+    std::chrono::steady_clock::duration get_delay(){ return delay; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static const int MAX_LATE = 3;            //frames we can be late before the schedule is restarted
+    static constexpr double MAX_SPEED = 1.05;
+    //the last part of the wait is spent spinning: sleeps often end later than asked
+    static constexpr std::chrono::microseconds SPIN{1000};
+    static const int WINDOW = 60;
+    static constexpr std::chrono::microseconds MARGIN{2000};  //time left for the presenter and the scheduler
+
+    Mode mode;
+    PRESENTER *presenter;
+    Clock::duration period;
+    Clock::time_point start;
+    Clock::time_point last;  //start of the previous frame
+    uint64_t frames = 0;     //frames since start
+    bool late = false;
+
+    Clock::duration delay{0};
+    bool auto_delay = false;
+    Clock::time_point started;                    //end of the last wait
+    std::array<Clock::duration, WINDOW> durations; //emulation time of the last frames
+    int next = 0;
+    int measured = 0;
+
+    void wait_until(Clock::time_point);
+    void measure(Clock::time_point now);
+};
+
+#endif /* pacer_hpp */
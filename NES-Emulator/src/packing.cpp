@@ -0,0 +1,89 @@
+//
+//  packing.cpp
+//  NES-Emulator
+//
+
+#include <cstring>
+
+#include "packing.hpp"
+
+
+size_t write_varint(uint64_t value, Byte *out){
+    size_t written = 0;
+    while(value >= 0x80){
+        out[written++] = (Byte) (value | 0x80);
+        value >>= 7;
+    }
+    out[written++] = (Byte) value;
+    return written;
+}
+
+bool read_varint(const Byte *in, size_t size, size_t &position, uint64_t &value){
+    value = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        if(position >= size)
+            return false;
+        Byte byte = in[position++];
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if(!(byte & 0x80))
+            return true;
+    }
+    return false; //more than 10 bytes
+}
+
+
+size_t pack_runs(const Byte *data, size_t size, Byte *out){
+    const size_t MIN_RUN = 4;
+    size_t written = 0;
+    size_t literal = 0; //start of the bytes not written yet
+    size_t i = 0;
+    while(i < size){
+        size_t run = 1;
+        while(i + run < size && data[i + run] == data[i])
+            run++;
+        if(run < MIN_RUN && i + run < size){
+            i += run;
+            continue;
+        }
+        if(run < MIN_RUN) //end of the data
+            i += run;
+        if(i > literal){
+            written += write_varint((i - literal) << 1, out + written);
+            std::memcpy(out + written, data + literal, i - literal);
+            written += i - literal;
+        }
+        if(run >= MIN_RUN){
+            written += write_varint(run << 1 | 1, out + written);
+            out[written++] = data[i];
+            i += run;
+        }
+        literal = i;
+    }
+    return written;
+}
+
+bool unpack_runs(const Byte *in, size_t size, Byte *out, size_t capacity){
+    size_t i = 0;
+    size_t written = 0;
+    while(i < size){
+        uint64_t token;
+        if(!read_varint(in, size, i, token))
+            return false;
+        uint64_t count = token >> 1;
+        if(count > capacity - written)
+            return false;
+        if(token & 1){
+            if(i >= size)
+                return false;
+            std::memset(out + written, in[i++], (size_t) count);
+        }
+        else{
+            if(count > size - i)
+                return false;
+            std::memcpy(out + written, in + i, (size_t) count);
+            i += (size_t) count;
+        }
+        written += (size_t) count;
+    }
+    return written == capacity;
+}
@@ -0,0 +1,28 @@
+//
+//  packing.hpp
+//  NES-Emulator
+//
+
+#ifndef packing_hpp
+#define packing_hpp
+
+#include <cstdint>
+#include <cstddef>
+
+typedef uint8_t Byte;
+
+
+//Small encodings shared by the save state tools (rewind, state library, movies).
+
+//7 bits per byte, lowest first, the high bit tells that more bytes follow
+size_t write_varint(uint64_t value, Byte *out);      //returns the number of bytes written (10 at most)
+bool read_varint(const Byte *in, size_t size, size_t &position, uint64_t &value); //false if it goes past size
+
+//runs of repeated bytes:
+//  [count << 1 | 1][byte]: count times the byte
+//  [count << 1][count bytes]: bytes as they are
+size_t pack_runs(const Byte *data, size_t size, Byte *out); //out must hold 2 * size + 10 bytes
+//false if the runs do not fill exactly `capacity` bytes (the data was not written by pack_runs)
+bool unpack_runs(const Byte *in, size_t size, Byte *out, size_t capacity);
+
+#endif /* packing_hpp */
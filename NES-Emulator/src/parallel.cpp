@@ -0,0 +1,216 @@
+//
+//  parallel.cpp
+//  NES-Emulator
+//
+
+#include <iostream>
+
+#include "parallel.hpp"
+
+
+PARALLEL::PARALLEL(NES *nes){
+    this->nes = nes;
+}
+
+PARALLEL::~PARALLEL(){
+    stop = true;
+    if(ppu_thread.joinable())
+        ppu_thread.join();
+}
+
+
+
+void PARALLEL::ppu_loop(){
+    PPU *ppu = nes->ppu;
+    while(!stop.load(std::memory_order_relaxed)){
+        //the ppu waits for the cpu, and for the cpu to learn about the last NMI
+        if(ppu->get_dots() >= limit.load(std::memory_order_acquire)
+           || (nmi_dot.load(std::memory_order_acquire) != 0 && !nmi_known.load(std::memory_order_acquire))){
+            std::this_thread::yield();
+            continue;
+        }
+
+        ppu->clock();
+        if(ppu->asknmi){
+            ppu->asknmi = false;
+            if(nmi_dot.load(std::memory_order_relaxed) == 0){ //otherwise the cpu has not taken the previous one yet, they are the same
+                nmi_known.store(false, std::memory_order_relaxed);
+                nmi_dot.store(ppu->get_dots(), std::memory_order_release);
+            }
+        }
+        if(ppu->is_frame_start()) //the cpu waits for the ppu (LEAD) while it sleeps
+            ppu->set_video(nes->frame_start());
+
+        //published last so that the cpu sees the NMI of every dot the ppu has done, and does not touch the ppu
+        //before the frame start is done
+        ppu_dots.store(ppu->get_dots(), std::memory_order_release);
+    }
+}
+
+
+
+void PARALLEL::save(){
+    Checkpoint checkpoint = {time, last_executed, *nes->cpu, *nes->ram, nes->controler_shifter, nes->strobe,
+                             nes->transfert_dma, nes->dma_offset, nes->dma_idle_cycle_done, next_input};
+    checkpoints.push_back(checkpoint);
+    if(checkpoints.size() > CHECKPOINTS)
+        checkpoints.pop_front();
+    while(first_input < checkpoints.front().input){ //no rollback can go before them
+        inputs.pop_front();
+        first_input++;
+    }
+}
+
+void PARALLEL::restore(uint64_t nmi){
+    //the NMI is taken by the first cpu cycle at or after nmi (cpu cycles are 3 dots apart)
+    //LEAD makes sure such a checkpoint exists: the cpu cannot be that far from the ppu when it learns about an NMI
+    while(checkpoints.size() > 1 && checkpoints.back().time > nmi + 2)
+        checkpoints.pop_back();
+    const Checkpoint &checkpoint = checkpoints.back();
+
+    rollbacks++;
+    replayed += time - checkpoint.time;
+
+    time = checkpoint.time;
+    last_executed = checkpoint.last_executed;
+    *nes->cpu = checkpoint.cpu;
+    *nes->ram = checkpoint.ram;
+    nes->controler_shifter = checkpoint.controler_shifter;
+    nes->strobe = checkpoint.strobe;
+    nes->transfert_dma = checkpoint.transfert_dma;
+    nes->dma_offset = checkpoint.dma_offset;
+    nes->dma_idle_cycle_done = checkpoint.dma_idle_cycle_done;
+    next_input = checkpoint.input;
+
+    accessed = false;
+    rollback_pending = false;
+    limit.store(time, std::memory_order_release);
+}
+
+bool PARALLEL::check_nmi(){
+    if(nmi_known.load(std::memory_order_acquire))
+        return false;
+    uint64_t nmi = nmi_dot.load(std::memory_order_acquire);
+    if(nmi == 0)
+        return false;
+
+    //the cpu has already executed a cycle where it should have taken this NMI
+    bool rolled_back = nmi <= last_executed;
+    if(rolled_back)
+        restore(nmi);
+
+    pending_nmi = nmi;
+    nmi_known.store(true, std::memory_order_release);
+    return rolled_back;
+}
+
+
+
+bool PARALLEL::access(){
+    if(rollback_pending) //the current instruction is thrown away
+        return false;
+
+    syncs++;
+    accessed = true;
+    bool waited = false;
+    while(1){
+        //ppu_dots first: the NMI of every dot it covers is visible
+        uint64_t dots = ppu_dots.load(std::memory_order_acquire);
+
+        if(!nmi_known.load(std::memory_order_acquire)){
+            uint64_t nmi = nmi_dot.load(std::memory_order_acquire);
+            if(nmi != 0 && nmi <= last_executed){ //we can not roll back in the middle of an instruction
+                rollback_pending = true;
+                return false;
+            }
+            if(nmi != 0){
+                pending_nmi = nmi;
+                nmi_known.store(true, std::memory_order_release);
+            }
+        }
+
+        if(dots >= time)
+            break;
+        waited = true;
+        std::this_thread::yield();
+    }
+    if(waited)
+        sync_waits++;
+    return true;
+}
+
+
+
+bool PARALLEL::replay_controller(Byte &value){
+    if(!is_replaying())
+        return false;
+    value = inputs[next_input++ - first_input];
+    return true;
+}
+
+void PARALLEL::controller_read(Byte value){
+    inputs.push_back(value);
+    next_input++;
+}
+
+
+
+void PARALLEL::report(){
+    std::cout << "parallel: " << syncs << " syncs (" << sync_waits << " waited for the ppu), "
+              << lead_waits << " lead waits, " << rollbacks << " rollbacks (" << replayed << " dots replayed)" << std::endl;
+}
+
+
+
+void PARALLEL::run(){
+    //NES::clock clocks the ppu before the cpu: the first cpu cycle happens after one dot
+    time = nes->ppu->get_dots() + 1;
+    ppu_dots = nes->ppu->get_dots();
+    limit = time;
+    save();
+    ppu_thread = std::thread(&PARALLEL::ppu_loop, this);
+
+    unsigned int cycles = 0;
+    while(1){
+        if(check_nmi()) //time went back
+            continue;
+        if(time > ppu_dots.load(std::memory_order_acquire) + LEAD){
+            lead_waits++;
+            std::this_thread::yield();
+            continue;
+        }
+        limit.store(time, std::memory_order_release);
+
+        //same as the cpu part of NES::clock
+        nes->cycle = (int) (time - 1);
+        accessed = false;
+        if(nes->transfert_dma)
+            nes->dma_cycle();
+        else if(pending_nmi != 0 && pending_nmi <= time){
+            nes->cpu->NMI();
+            pending_nmi = 0;
+            nmi_dot.store(0, std::memory_order_release);
+        }
+        else{
+            last_executed = time;
+            nes->cpu->clock();
+        }
+
+        if(rollback_pending){
+            check_nmi(); //restores the checkpoint
+            continue;
+        }
+
+        time += 3;
+        //the cpu can not go back before an access to the ppu
+        if(accessed)
+            checkpoints.clear();
+        if(accessed || time >= checkpoints.back().time + CHECKPOINT_INTERVAL)
+            save();
+
+        if(++cycles % 0x10000 == 0 && nes->input->should_quit()){
+            report();
+            return;
+        }
+    }
+}
@@ -0,0 +1,105 @@
+//
+//  parallel.hpp
+//  NES-Emulator
+//
+
+#ifndef parallel_hpp
+#define parallel_hpp
+
+#include <array>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+#include "nes.hpp"
+
+
+//Runs the cpu and the ppu on two threads.
+//
+//The ppu thread clocks the ppu as long as it is not ahead of the cpu. The cpu thread runs ahead of the
+//ppu (at most LEAD dots) and only waits for it when it touches the ppu: registers, OAM DMA.
+//These accesses are done exactly at the dot they would happen at in NES::clock, so they are never speculative.
+//
+//The only thing the cpu can miss while it is ahead is an NMI: the ppu raises it at a dot the cpu may have
+//already executed. The cpu regularly saves its state (checkpoints), and when it learns about an NMI it should
+//have taken earlier, it restores the last checkpoint before that dot and executes again, taking the NMI this time.
+//The ppu stops right after raising an NMI until the cpu knows about it, and the cpu cannot touch the ppu
+//past a checkpoint, so the ppu never has to be rolled back.
+//The controllers are read from the live input, which consumes the tapped buttons (see INPUT): the values read since
+//the oldest checkpoint are kept, and after a rollback the reads done again get the same values in the same order.
+//
+//The number of synchronizations and rollbacks is printed when the emulation stops.
+class PARALLEL{
+private:
+    NES *nes;
+
+    static const uint64_t LEAD = 3 * 361;           //how far (in dots) the cpu can be ahead of the ppu
+    static const uint64_t CHECKPOINT_INTERVAL = 512; //dots between two checkpoints
+    static const int CHECKPOINTS = 6;                //must cover more than LEAD
+
+    //shared by the two threads
+    std::atomic<uint64_t> limit{0};       //the ppu can clock until it has done this many dots
+    std::atomic<uint64_t> ppu_dots{0};    //dots done by the ppu
+    std::atomic<uint64_t> nmi_dot{0};     //dot at which the ppu raised an NMI the cpu has not taken yet, 0 if none
+    std::atomic<bool> nmi_known{false};   //the cpu knows about this NMI, the ppu can go on
+    std::atomic<bool> stop{false};
+    std::thread ppu_thread;
+
+    //cpu thread
+    uint64_t time = 0;          //dots the ppu must have done before the current cpu cycle (as in NES::clock)
+    uint64_t last_executed = 0; //time of the last cycle where the cpu executed instead of taking an NMI
+    uint64_t pending_nmi = 0;   //NMI the cpu knows about and will take at its next cycle (if no DMA is running)
+    bool accessed = false;      //the ppu was touched during the current cycle
+    bool rollback_pending = false;
+
+    struct Checkpoint{
+        uint64_t time;
+        uint64_t last_executed;
+        CPU cpu;
+        std::array<Byte, 2048> ram;
+        std::array<Byte, 2> controler_shifter;
+        bool strobe;
+        bool transfert_dma;
+        Byte dma_offset;
+        bool dma_idle_cycle_done;
+        uint64_t input;             //controller reads done before it
+    };
+    std::deque<Checkpoint> checkpoints; //oldest first
+
+    std::deque<Byte> inputs;    //values of the controller reads since the oldest checkpoint
+    uint64_t first_input = 0;   //number of the first one
+    uint64_t next_input = 0;    //number of the next read, it is one of inputs while they are read again after a rollback
+
+    //instrumentation (cpu thread)
+    uint64_t syncs = 0;         //accesses to the ppu
+    uint64_t sync_waits = 0;    //accesses where the ppu was late
+    uint64_t lead_waits = 0;    //cycles where the cpu was LEAD dots ahead
+    uint64_t rollbacks = 0;
+    uint64_t replayed = 0;      //dots executed again because of rollbacks
+
+    void ppu_loop();
+    void save();
+    void restore(uint64_t nmi);
+    bool check_nmi();   //true if it rolled back
+    void report();
+
+public:
+    PARALLEL(NES *);
+    ~PARALLEL();
+
+    //cpu thread, returns when the user quits
+    void run();
+
+    //called by the cpu before it touches the ppu, waits for the ppu to reach the current dot
+    //returns false if the cpu must roll back, the access must then be dropped
+    bool access();
+
+    //controller reads (cpu thread): replay_controller gives the value read the first time while the reads are
+    //done again after a rollback, otherwise the value read from the input is given to controller_read
+    bool is_replaying(){ return next_input < first_input + inputs.size(); }
+    bool replay_controller(Byte &value);
+    void controller_read(Byte value);
+};
+
+#endif /* parallel_hpp */
@@ -12,275 +12,154 @@
 #include "screen.hpp"
 #include "ppu.hpp"
 #include "nes.hpp"
+#include "deferred.hpp"
 
 
 /*
     Constructor
 */
-PPU::PPU(NES *nes, float screen_coef){
+PPU::PPU(NES *nes, PRESENTER *presenter){
     this->nes = nes;
-    this->graphics = new GRAPHICS(screen_coef);
-    /*
-    define the palette
-    https://wiki.nesdev.org/w/index.php/PPU_palettes#Palettes
-    */
-    this->palette->at(0x00).r = 84;
-    this->palette->at(0x00).g = 84;
-    this->palette->at(0x00).b = 84;
-    
-    this->palette->at(0x10).r = 152;
-    this->palette->at(0x10).g = 150;
-    this->palette->at(0x10).b = 152;
-    
-    this->palette->at(0x20).r = 236;
-    this->palette->at(0x20).g = 238;
-    this->palette->at(0x20).b = 236;
-    
-    this->palette->at(0x30).r = 236;
-    this->palette->at(0x30).g = 238;
-    this->palette->at(0x30).b = 236;
-    
-    this->palette->at(0x11).r = 0;
-    this->palette->at(0x11).g = 30;
-    this->palette->at(0x11).b = 116;
-    
-    this->palette->at(0x11).r = 8;
-    this->palette->at(0x11).g = 76;
-    this->palette->at(0x11).b = 196;
-    
-    this->palette->at(0x21).r = 76;
-    this->palette->at(0x21).g = 154;
-    this->palette->at(0x21).b = 236;
-    
-    this->palette->at(0x31).r = 168;
-    this->palette->at(0x31).g = 204;
-    this->palette->at(0x31).b = 236;
-    
-    this->palette->at(0x02).r = 8;
-    this->palette->at(0x02).g = 16;
-    this->palette->at(0x02).b = 144;
-    
-    this->palette->at(0x12).r = 48;
-    this->palette->at(0x12).g = 50;
-    this->palette->at(0x12).b = 236;
-    
-    this->palette->at(0x22).r = 120;
-    this->palette->at(0x22).g = 124;
-    this->palette->at(0x22).b = 236;
-    
-    this->palette->at(0x32).r = 188;
-    this->palette->at(0x32).g = 188;
-    this->palette->at(0x32).b = 236;
-    
-    this->palette->at(0x03).r = 48;
-    this->palette->at(0x03).g = 0;
-    this->palette->at(0x03).b = 136;
-    
-    this->palette->at(0x13).r = 92;
-    this->palette->at(0x13).g = 30;
-    this->palette->at(0x13).b = 228;
-    
-    this->palette->at(0x23).r = 176;
-    this->palette->at(0x23).g = 98;
-    this->palette->at(0x23).b = 236;
-    
-    this->palette->at(0x33).r = 212;
-    this->palette->at(0x33).g = 178;
-    this->palette->at(0x33).b = 236;
-    
-    this->palette->at(0x04).r = 68;
-    this->palette->at(0x04).g = 0;
-    this->palette->at(0x04).b = 100;
-    
-    this->palette->at(0x14).r = 136;
-    this->palette->at(0x14).g = 20;
-    this->palette->at(0x14).b = 176;
+    this->presenter = presenter;
+    this->owns_frame = presenter == NULL;
+    this->frame = presenter != NULL ? presenter->get_back() : new Frame; //without presenter the frames are rendered in the same buffer
+}
 
-    this->palette->at(0x24).r = 228;
-    this->palette->at(0x24).g = 84;
-    this->palette->at(0x24).b = 236;
-    
-    this->palette->at(0x34).r = 236;
-    this->palette->at(0x34).g = 174;
-    this->palette->at(0x34).b = 236;
-    
-    this->palette->at(0x05).r = 92;
-    this->palette->at(0x05).g = 0;
-    this->palette->at(0x05).b = 48;
-    
-    this->palette->at(0x15).r = 160;
-    this->palette->at(0x15).g = 20;
-    this->palette->at(0x15).b = 100;
+PPU::~PPU(){
+    if(this->owns_frame)
+        delete this->frame;
+}
 
-    this->palette->at(0x25).r = 236;
-    this->palette->at(0x25).g = 88;
-    this->palette->at(0x25).b = 180;
-    
-    this->palette->at(0x35).r = 236;
-    this->palette->at(0x35).g = 174;
-    this->palette->at(0x35).b = 212;
-    
-    this->palette->at(0x06).r = 84;
-    this->palette->at(0x06).g = 4;
-    this->palette->at(0x06).b = 0;
-    
-    this->palette->at(0x16).r = 152;
-    this->palette->at(0x16).g = 34;
-    this->palette->at(0x16).b = 32;
 
-    this->palette->at(0x26).r = 236;
-    this->palette->at(0x26).g = 106;
-    this->palette->at(0x26).b = 100;
-    
-    this->palette->at(0x36).r = 236;
-    this->palette->at(0x36).g = 180;
-    this->palette->at(0x36).b = 176;
-    
-    this->palette->at(0x07).r = 60;
-    this->palette->at(0x07).g = 24;
-    this->palette->at(0x07).b = 0;
-    
-    this->palette->at(0x17).r = 120;
-    this->palette->at(0x17).g = 60;
-    this->palette->at(0x17).b = 0;
+void PPU::set_deferred(DEFERRED *deferred){
+    this->deferred = deferred;
+    this->timing_only = true;
+    this->log = new std::vector<PPU_ACCESS>;
+}
 
-    this->palette->at(0x27).r = 212;
-    this->palette->at(0x27).g = 136;
-    this->palette->at(0x27).b = 32;
-    
-    this->palette->at(0x37).r = 228;
-    this->palette->at(0x37).g = 196;
-    this->palette->at(0x37).b = 144;
-    
-    this->palette->at(0x08).r = 32;
-    this->palette->at(0x08).g = 42;
-    this->palette->at(0x08).b = 0;
-    
-    this->palette->at(0x18).r = 84;
-    this->palette->at(0x18).g = 90;
-    this->palette->at(0x18).b = 0;
-    
-    this->palette->at(0x28).r = 160;
-    this->palette->at(0x28).g = 170;
-    this->palette->at(0x28).b = 0;
-    
-    this->palette->at(0x38).r = 204;
-    this->palette->at(0x38).g = 210;
-    this->palette->at(0x38).b = 120;
-    
-    this->palette->at(0x09).r = 8;
-    this->palette->at(0x09).g = 58;
-    this->palette->at(0x09).b = 0;
-    
-    this->palette->at(0x19).r = 40;
-    this->palette->at(0x19).g = 114;
-    this->palette->at(0x19).b = 0;
-    
-    this->palette->at(0x29).r = 116;
-    this->palette->at(0x29).g = 196;
-    this->palette->at(0x29).b = 0;
-    
-    this->palette->at(0x39).r = 180;
-    this->palette->at(0x39).g = 222;
-    this->palette->at(0x39).b = 120;
-    
-    this->palette->at(0x0A).r = 0;
-    this->palette->at(0x0A).g = 64;
-    this->palette->at(0x0A).b = 0;
-    
-    this->palette->at(0x1A).r = 8;
-    this->palette->at(0x1A).g = 124;
-    this->palette->at(0x1A).b = 0;
-    
-    this->palette->at(0x2A).r = 76;
-    this->palette->at(0x2A).g = 208;
-    this->palette->at(0x2A).b = 32;
-    
-    this->palette->at(0x3A).r = 168;
-    this->palette->at(0x3A).g = 226;
-    this->palette->at(0x3A).b = 144;
-    
-    this->palette->at(0x0B).r = 0;
-    this->palette->at(0x0B).g = 60;
-    this->palette->at(0x0B).b = 0;
-    
-    this->palette->at(0x1B).r = 0;
-    this->palette->at(0x1B).g = 118;
-    this->palette->at(0x1B).b = 40;
-    
-    this->palette->at(0x2B).r = 56;
-    this->palette->at(0x2B).g = 204;
-    this->palette->at(0x2B).b = 108;
-    
-    this->palette->at(0x3B).r = 152;
-    this->palette->at(0x3B).g = 226;
-    this->palette->at(0x3B).b = 180;
-    
-    this->palette->at(0x0C).r = 0;
-    this->palette->at(0x0C).g = 50;
-    this->palette->at(0x0C).b = 60;
-    
-    this->palette->at(0x1C).r = 0;
-    this->palette->at(0x1C).g = 102;
-    this->palette->at(0x1C).b = 120;
-    
-    this->palette->at(0x2C).r = 56;
-    this->palette->at(0x2C).g = 180;
-    this->palette->at(0x2C).b = 204;
-    
-    this->palette->at(0x3C).r = 160;
-    this->palette->at(0x3C).g = 214;
-    this->palette->at(0x3C).b = 228;
-    
-    this->palette->at(0x0D).r = 0;
-    this->palette->at(0x0D).g = 0;
-    this->palette->at(0x0D).b = 0;
-    
-    this->palette->at(0x1D).r = 0;
-    this->palette->at(0x1D).g = 0;
-    this->palette->at(0x1D).b = 0;
-    
-    this->palette->at(0x2D).r = 60;
-    this->palette->at(0x2D).g = 60;
-    this->palette->at(0x2D).b = 60;
-    
-    this->palette->at(0x3D).r = 160;
-    this->palette->at(0x3D).g = 162;
-    this->palette->at(0x3D).b = 160;
-    
-    this->palette->at(0x0E).r = 0;
-    this->palette->at(0x0E).g = 0;
-    this->palette->at(0x0E).b = 0;
-    
-    this->palette->at(0x1E).r = 0;
-    this->palette->at(0x1E).g = 0;
-    this->palette->at(0x1E).b = 0;
-    
-    this->palette->at(0x2E).r = 0;
-    this->palette->at(0x2E).g = 0;
-    this->palette->at(0x2E).b = 0;
-    
-    this->palette->at(0x3E).r = 0;
-    this->palette->at(0x3E).g = 0;
-    this->palette->at(0x3E).b = 0;
-    
-    this->palette->at(0x0F).r = 0;
-    this->palette->at(0x0F).g = 0;
-    this->palette->at(0x0F).b = 0;
-    
-    this->palette->at(0x1F).r = 0;
-    this->palette->at(0x1F).g = 0;
-    this->palette->at(0x1F).b = 0;
-    
-    this->palette->at(0x2F).r = 0;
-    this->palette->at(0x2F).g = 0;
-    this->palette->at(0x2F).b = 0;
-    
-    this->palette->at(0x3F).r = 0;
-    this->palette->at(0x3F).g = 0;
-    this->palette->at(0x3F).b = 0;
+void PPU::copy_memory(const PPU &ppu){
+    *this->Pattern_table = *ppu.Pattern_table;
+    *this->Nametable = *ppu.Nametable;
+    *this->Palette = *ppu.Palette;
+    *this->OAM = *ppu.OAM;
 }
 
+void PPU::save_state(State &state){
+    state.dots = this->dots;
+    state.scanline = this->scanline;
+    state.cycle = this->cycle;
+    state.odd_frame = this->odd_frame;
+    state.registers = this->registers;
+    state.last_available_slot = this->last_available_slot;
+    state.n = this->n;
+    state.sprite_cycle = this->sprite_cycle;
+    state.sprite_data_read = this->sprite_data_read;
+    state.sprite_search_is_done = this->sprite_search_is_done;
+    state.number_of_sprites = this->number_of_sprites;
+    state.is_sprite_0_there = this->is_sprite_0_there;
+    state.is_sprite_0_loaded = this->is_sprite_0_loaded;
+    state.vmem_addr = this->vmem_addr;
+    state.addr_t = this->addr_t;
+    state.fine_x_scroll = this->fine_x_scroll;
+    state.write_toggle = this->write_toggle;
+    state.asknmi = this->asknmi;
+    state.read_buffer = this->read_buffer;
+
+    //the memory is on the heap
+    state.Pattern_table = *this->Pattern_table;
+    state.Nametable = *this->Nametable;
+    state.Palette = *this->Palette;
+    state.OAM = *this->OAM;
+    state.Sec_OAM = *this->Sec_OAM;
+
+    //without video the render pipeline only runs on the lines where sprite 0 can hit (see clock), so it is only kept
+    //while it holds something which will be used, and left to zero otherwise: the states at a frame boundary are the same
+    //with or without video
+    //from dot 257 of the pre-render line, the sprites and the first tiles of the first line are loaded, or the pipeline is
+    //cleared if rendering is disabled (see clock)
+    if((this->scanline >= 0 && this->scanline <= 239) || (this->scanline == -1 && this->cycle >= 258)){
+        state.pattern_data_shift_register_1 = this->pattern_data_shift_register_1;
+        state.pattern_data_shift_register_2 = this->pattern_data_shift_register_2;
+        state.palette_attribute_shift_register_1 = this->palette_attribute_shift_register_1;
+        state.palette_attribute_shift_register_2 = this->palette_attribute_shift_register_2;
+        state.pattern_data_shift_register_1_latch = this->pattern_data_shift_register_1_latch;
+        state.pattern_data_shift_register_2_latch = this->pattern_data_shift_register_2_latch;
+        state.next_pattern_data_shift_register_location = this->next_pattern_data_shift_register_location;
+        state.palette_attribute_shift_register_1_latch = this->palette_attribute_shift_register_1_latch;
+        state.palette_attribute_shift_register_2_latch = this->palette_attribute_shift_register_2_latch;
+        state.sprite_shift_registers = *this->sprite_shift_registers;
+        state.sprite_latches = *this->sprite_latches;
+        state.sprite_counters = *this->sprite_counters;
+    }
+    //the pixels of a line are generated from dot 1 and composited by dot 256
+    if(this->scanline >= 0 && this->scanline <= 239 && this->cycle >= 2 && this->cycle <= 256){
+        state.staged_pixels = this->staged_pixels;
+        state.composited_pixels = this->composited_pixels;
+        state.line_background = *this->line_background;
+        state.line_sprites = *this->line_sprites;
+        state.line_addresses = *this->line_addresses;
+    }
+}
+
+void PPU::clear_pipeline(){
+    this->pattern_data_shift_register_1 = 0x0000;
+    this->pattern_data_shift_register_2 = 0x0000;
+    this->palette_attribute_shift_register_1 = 0x0000;
+    this->palette_attribute_shift_register_2 = 0x0000;
+    this->pattern_data_shift_register_1_latch = 0x00;
+    this->pattern_data_shift_register_2_latch = 0x00;
+    this->next_pattern_data_shift_register_location = 0x00;
+    this->palette_attribute_shift_register_1_latch = false;
+    this->palette_attribute_shift_register_2_latch = false;
+    this->sprite_shift_registers->fill({0x00, 0x00});
+    this->sprite_latches->fill(0x00);
+    this->sprite_counters->fill(0x00);
+}
+
+void PPU::load_state(const State &state){
+    this->dots = state.dots;
+    this->scanline = state.scanline;
+    this->cycle = state.cycle;
+    this->odd_frame = state.odd_frame;
+    this->registers = state.registers;
+    this->staged_pixels = state.staged_pixels;
+    this->composited_pixels = state.composited_pixels;
+    this->pattern_data_shift_register_1 = state.pattern_data_shift_register_1;
+    this->pattern_data_shift_register_2 = state.pattern_data_shift_register_2;
+    this->palette_attribute_shift_register_1 = state.palette_attribute_shift_register_1;
+    this->palette_attribute_shift_register_2 = state.palette_attribute_shift_register_2;
+    this->pattern_data_shift_register_1_latch = state.pattern_data_shift_register_1_latch;
+    this->pattern_data_shift_register_2_latch = state.pattern_data_shift_register_2_latch;
+    this->next_pattern_data_shift_register_location = state.next_pattern_data_shift_register_location;
+    this->palette_attribute_shift_register_1_latch = state.palette_attribute_shift_register_1_latch;
+    this->palette_attribute_shift_register_2_latch = state.palette_attribute_shift_register_2_latch;
+    this->last_available_slot = state.last_available_slot;
+    this->n = state.n;
+    this->sprite_cycle = state.sprite_cycle;
+    this->sprite_data_read = state.sprite_data_read;
+    this->sprite_search_is_done = state.sprite_search_is_done;
+    this->number_of_sprites = state.number_of_sprites;
+    this->is_sprite_0_there = state.is_sprite_0_there;
+    this->is_sprite_0_loaded = state.is_sprite_0_loaded;
+    this->vmem_addr = state.vmem_addr;
+    this->addr_t = state.addr_t;
+    this->fine_x_scroll = state.fine_x_scroll;
+    this->write_toggle = state.write_toggle;
+    this->asknmi = state.asknmi;
+    this->read_buffer = state.read_buffer;
+
+    *this->Pattern_table = state.Pattern_table;
+    *this->Nametable = state.Nametable;
+    *this->Palette = state.Palette;
+    *this->line_background = state.line_background;
+    *this->line_sprites = state.line_sprites;
+    *this->line_addresses = state.line_addresses;
+    *this->OAM = state.OAM;
+    *this->Sec_OAM = state.Sec_OAM;
+    *this->sprite_shift_registers = state.sprite_shift_registers;
+    *this->sprite_latches = state.sprite_latches;
+    *this->sprite_counters = state.sprite_counters;
+}
 
 /*
  Registers
@@ -295,6 +174,7 @@ Byte PPU::getPPUMASK(){
 }
 //get PPU status register
 Byte PPU::getPPUSTATUS(){
+    composite(); //sprite 0 hit may be waiting in the pixels not composited yet
     //7  bit  0
     //---- ----
     //VSO. ....
@@ -330,6 +210,7 @@ void PPU::setPPUCTRL(Byte data){
 }
 //set PPU mask register
 void PPU::setPPUMASK(Byte data){
+    composite(); //the pixels already generated use the old mask
     this->registers.PPUMASK = data;
 }
 //set PPU status register
@@ -355,15 +236,160 @@ void PPU::setPPUADDR(Byte data){
 }
 //set OAM DMA register (high byte)
 void PPU::setOAMDMA(Byte data){
+    if(this->log)
+        this->log->push_back({this->dots, 0x4014, data, PPU_ACCESS::DMA_PAGE});
     this->registers.OAMDMA = data;
 }
 
 void PPU::setOAM_with_addr(Byte content, Address addr){
+    if(this->log)
+        this->log->push_back({this->dots, addr, content, PPU_ACCESS::OAM_DMA});
     ((uint8_t *)this->OAM)[addr] = content;
     //we convert it to a pointer in order to write the appropriate byte location
 }
 
 
+//registers as seen from the cpu ($2000 ~ $3FFF)
+void PPU::write_register(Address addr, Byte content){
+    if(this->log)
+        this->log->push_back({this->dots, addr, content, PPU_ACCESS::WRITE});
+
+    //The PPU exposes eight memory-mapped registers to the CPU. These nominally sit at $2000 through $2007 in the CPU's address space, but because they're incompletely decoded, they're mirrored in every 8 bytes from $2008 through $3FFF, so a write to $3456 is the same as a write to $2006.
+    switch (addr % 8) {
+        case 0: //ppuctrl
+            this->setPPUCTRL(content);
+            //https://wiki.nesdev.org/w/index.php?title=PPU_scrolling
+            //t: ... GH.. .... .... <- d: ......GH
+            this->addr_t = (this->addr_t & 0xF3FF) | ((content & 0x03) << 10);
+            break;
+            
+        case 1: //ppumask
+            this->setPPUMASK(content);
+            break;
+  
+        case 3:
+            this->setOAMADDR(content);
+            break;
+
+        case 4:
+            this->setOAMDATA(content);
+            break;
+            
+        case 5:{
+            //https://wiki.nesdev.org/w/index.php?title=PPU_scrolling
+            //t: ....... ...ABCDE <- d: ABCDE...
+            //x:              FGH <- d: .....FGH
+            //w:                  <- 1
+            if(!this->write_toggle){//first write
+                this->addr_t = (this->addr_t & 0xFFE0) | (content >> 3);
+                this->fine_x_scroll = content & 0x07;
+                this->write_toggle = true;
+            }
+            //t: FGH ..AB CDE. .... <- d: ABCDEFGH
+            //w:                  <- 0
+            else{//second write
+//                    this->addr_t = ((((content & 0x07) << 12) | (this->addr_t & 0x0FFF)) & 0xFC1F) | ((content & 0xF8) << 5);
+                this->addr_t &= 0x0C1F;
+                this->addr_t |= ((content >> 3) << 5);
+                this->addr_t |= ((content & 0x7) << 12);
+                this->write_toggle = false;
+            }
+            break;
+        }
+
+        case 6:{
+            //https://wiki.nesdev.org/w/index.php?title=PPU_scrolling
+            //t: .CD EFGH .... .... <- d: ..CD EFGH
+            //       <unused>     <- d: AB......
+            //t: Z.. .... .... .... <- 0 (bit Z is cleared)
+            //w:                  <- 1
+            if(!this->write_toggle){//first write
+                this->addr_t &= 0x00FF;
+                this->addr_t |= (( (Address) (content & 0x3F) << 8));
+//                    this->addr_t = (this->addr_t & 0x00FF) | ((content & 0x3F) << 8);
+                this->write_toggle = true;
+            }
+            //t: ....... ABCDEFGH <- d: ABCDEFGH
+            //v: <...all bits...> <- t: <...all bits...>
+            //w:                  <- 0
+            else{//second write
+                //Valid addresses are $0000-$3FFF; higher addresses will be mirrored down.
+                this->addr_t = (this->addr_t & 0xFF00) | content;
+                this->vmem_addr = this->addr_t;
+                this->write_toggle = false;
+            }
+            break;
+        }
+            
+        case 7:{ //you can read or write data from VRAM through this port
+            this->write(this->vmem_addr, content);
+
+            //VRAM read/write data register. After access, the video memory address will increment by an amount determined by bit 2 of $2000.
+            //(0: add 1, going across; 1: add 32, going down)
+            if(this->getPPUCTRL() & 0x04)
+                this->vmem_addr += 32;
+            else
+                this->vmem_addr += 1;
+            break;
+        }
+            
+        //some registers are read-only
+        default:
+            break;
+    }
+}
+
+Byte PPU::read_register(Address addr){
+    if(this->log && (addr % 8 == 2 || addr % 8 == 7)) //the other reads do not change anything
+        this->log->push_back({this->dots, addr, 0x00, PPU_ACCESS::READ});
+
+    //The PPU exposes eight memory-mapped registers to the CPU. These nominally sit at $2000 through $2007 in the CPU's address space, but because they're incompletely decoded, they're mirrored in every 8 bytes from $2008 through $3FFF, so a write to $3456 is the same as a write to $2006.
+    switch (addr % 8) {
+        case 2:{
+            Byte buffer = this->getPPUSTATUS(); //reading the register affect it's value
+            this->setPPUSTATUS(buffer & 0x7F); //Reading the status register will clear bit 7
+            this->write_toggle = false;  //Reading the status register will clear the address latch used by PPUSCROLL and PPUADDR.
+            return buffer;
+            break;
+        }
+
+        case 4:{
+            return this->getOAMDATA();
+            break;
+        }
+            
+        case 7:{
+            //When reading while the VRAM address is in the range 0-$3EFF (i.e., before the palettes), the read will return the contents of an internal read buffer. This internal buffer is updated only when reading PPUDATA, and so is preserved across frames. After the CPU reads and gets the contents of the internal buffer, the PPU will immediately update the internal buffer with the byte at the current VRAM address. Thus, after setting the VRAM address, one should first read this register to prime the pipeline and discard the result.
+            //Reading palette data from $3F00-$3FFF works differently. The palette data is placed immediately on the data bus, and hence no priming read is required. Reading the palettes still updates the internal buffer though, but the data placed in it is the mirrored nametable data that would appear "underneath" the palette.
+            Byte buffer = this->read_buffer;
+            this->read_buffer = this->read(this->vmem_addr);
+            
+            Byte data_to_return = 0x00;
+            
+            if(this->vmem_addr <= 0x3EFF)
+                data_to_return = buffer;
+            else
+                data_to_return = this->read_buffer;
+            
+            //VRAM read/write data register. After access, the video memory address will increment by an amount determined by bit 2 of $2000.
+            //(0: add 1, going across; 1: add 32, going down)
+            if(this->getPPUCTRL() & 0x04)
+                this->vmem_addr += 32;
+            else
+                this->vmem_addr += 1;
+            
+            return data_to_return;
+            break;
+        }
+            
+        //not all registers are readable
+        default:
+            return 0x00;
+            break;
+    }
+}
+
+
 void PPU::write(Address addr, Byte content){
     //The pattern table is divided into two 256-tile sections: $0000-$0FFF, nicknamed "left", and $1000-$1FFF, nicknamed "right". The nicknames come from how emulators with a debugger display the pattern table. Traditionally, they are displayed as two side-by-side 128x128 pixel sections, each representing 16x16 tiles from the pattern table, with $0000-$0FFF on the left and $1000-$1FFF on the right.
     if(addr <= 0x1FFF) //tablepattern
@@ -422,6 +448,7 @@ void PPU::write(Address addr, Byte content){
         //Addresses $3F04/$3F08/$3F0C can contain unique data, though these values are not used by the PPU when normally rendering (since the pattern values that would otherwise select those cells select the backdrop color instead).
         //Addresses $3F10/$3F14/$3F18/$3F1C are mirrors of $3F00/$3F04/$3F08/$3F0C. Note that this goes for writing as well as reading.
         //$3F20-$3FFF    $00E0    Mirrors of $3F00-$3F1F
+        composite(); //the pixels already generated use the old colors
         this->Palette->at(addr & 0x001F) = content;
         switch (addr & 0x000F) {
             case 0x00:
@@ -582,6 +609,32 @@ void PPU::shift(){
     }
 }
 
+//write the staged pixels of the current line to the frame
+void PPU::composite(){
+    if(this->composited_pixels >= this->staged_pixels)
+        return;
+
+    int hit = this->compositor.run(this->line_background->data(), this->line_sprites->data(), this->line_addresses->data(),
+                                   this->composited_pixels, this->staged_pixels, this->registers.PPUMASK);
+    if(hit >= 0)
+        this->registers.PPUSTATUS |= 0x40; //set sprite 0 hit flag.
+
+    //43210
+    //|||||
+    //|||++- Pixel value from tile data
+    //|++--- Palette number from attribute table or OAM
+    //+----- Background/Sprite select
+    //the palette ram is read directly: there is no need to go through the whole address decoding
+    Byte grey = (this->registers.PPUMASK & 0x01) ? 0x30 : 0x3F; //greyscale
+    Pixel emphasis = (this->registers.PPUMASK & 0xE0) << 1; //emphasis bits are kept for the output stage
+    Pixel *line = &(*this->frame)[this->scanline * 256];
+    if(this->renders()) //only sprite 0 hit matters in timing only mode and without video
+        for(int x = this->composited_pixels; x < this->staged_pixels; x++)
+            line[x] = ((*this->Palette)[(*this->line_addresses)[x]] & 0x3F & grey) | emphasis;
+
+    this->composited_pixels = this->staged_pixels;
+}
+
 void PPU::incY(){
     if ((this->vmem_addr & 0x7000) != 0x7000)
         this->vmem_addr += 0x1000; //incr fine Y
@@ -604,14 +657,19 @@ void PPU::incY(){
 
 
 void PPU::clock(){
+    //the sprites loaded at dot 257 are the ones of the next line, whose first tiles are fetched from dot 321
+    bool pixels = this->renders() || this->is_sprite_0_loaded;
+
     //https://wiki.nesdev.org/w/index.php?title=File:Ntsc_timing.png
     if((this->registers.PPUMASK & 0x18) && (this->scanline <= 239)){//it includes the pre-render line
         if((this->scanline == -1) && (this->cycle == 1)){
             this->registers.PPUSTATUS &= 0x1F; //clear vblank, sprite overflow and sprite 0 hit
         }
 
+        //in timing only mode the fetches and the shifters only matter on the lines where sprite 0 can hit
         if((this->cycle >= 1) && ((this->cycle <= 256) || ((this->cycle >= 321) && (this->cycle <= 337)))){
-            shift();
+            if(pixels)
+                shift();
             
             switch (this->cycle % 8) {
                 case 0: //inc hori(v)
@@ -619,20 +677,25 @@ void PPU::clock(){
                     break;
 
                 case 1: //NT Byte
-                    reloadShifters();
-                    ntbyte();
+                    if(pixels){
+                        reloadShifters();
+                        ntbyte();
+                    }
                     break;
 
                 case 3: // AT Byte
-                    ATByte();
+                    if(pixels)
+                        ATByte();
                     break;
 
                 case 5: //low BG Tile
-                    LowBGByteTile();
+                    if(pixels)
+                        LowBGByteTile();
                     break;
 
                 case 7://high BG Tile
-                    HighBGByteTile();
+                    if(pixels)
+                        HighBGByteTile();
                     break;
 
                 default://second cycle of the opperation
@@ -644,7 +707,8 @@ void PPU::clock(){
             incY();
 
         else if(this->cycle == 257){
-            reloadShifters();
+            if(pixels)
+                reloadShifters();
             this->vmem_addr = (this->vmem_addr & 0xFBE0) | (this->addr_t & 0x041F);
         }
 
@@ -802,6 +866,7 @@ void PPU::clock(){
             //it is easier to implement and runs faster
             if(this->cycle == 257){
                 this->number_of_sprites = this->last_available_slot;
+                this->is_sprite_0_loaded = this->is_sprite_0_there;
                 
                 for(int i = 0; i < this->last_available_slot; i++){
                     //generate pattern addr from which we'll fetch the sprite pattern data
@@ -882,12 +947,13 @@ void PPU::clock(){
     /*
      Actual rendering
     */
-    if(this->cycle <= 257 && this->scanline <= 239){//when a pixel can be drown and durring the pre render line because it costs more to check each time if we're not in the prerender line
+    //the pixel of cycle 1 is the first pixel of the line
+    if(pixels && (this->scanline >= 0) && (this->scanline <= 239) && (this->cycle >= 1) && (this->cycle <= 256)){
         //foreground
         Byte fg_pixel = 0x00;
         Byte fg_palette = 0x00;
-        bool priority = false;
-        is_sprite_0_rendering = false; //we assume we're not rendering sprite 0
+        bool behind = false;
+        bool is_sprite_0 = false;
         if(this->registers.PPUMASK & 0x10){ //if sprite rendering in enabled
             for(int i = 0; i < this->number_of_sprites; i++){//if this sprite has been fetched
                     if(this->sprite_counters->at(i) == 0){//if it's time to render the sprite
@@ -898,12 +964,11 @@ void PPU::clock(){
                             fg_pixel = ((this->sprite_shift_registers->at(i).at(1) & 0x80) >> 6) | ((this->sprite_shift_registers->at(i).at(0) & 0x80) >> 7);
                         }
                         
-                        fg_palette = (this->sprite_latches->at(i) & 0x03) | 0x04; //|0x04 added to offset in the sprite palette
-                        priority = (this->sprite_latches->at(i) & 0x20) == 0; //0 = in front of background
+                        fg_palette = this->sprite_latches->at(i) & 0x03;
+                        behind = (this->sprite_latches->at(i) & 0x20) != 0; //0 = in front of background
                         
                         if(fg_pixel != 0x00){//if the pixel is not transparent
-                            if(this->is_sprite_0_there && i == 0) //currently rendering sprite 0!
-                                is_sprite_0_rendering = true;
+                            is_sprite_0 = this->is_sprite_0_loaded && i == 0;
                             break; //sprites are looked at from the highest priority to the lowest
                         }
                 }
@@ -923,41 +988,23 @@ void PPU::clock(){
         Byte bg_pixel = (pixel_value_high << 1) | pixel_value_low;
         Byte bg_palette = (palette_value_high << 1) | palette_value_low;
         
-        Byte final_pixel = 0x00;
-        Byte final_palette = 0x00;
-        
-        
-        //How sprite priority works: https://wiki.nesdev.org/w/index.php?title=PPU_sprite_priority
-        if(fg_pixel != 0){//foreground pixel is not transparent
-            if((bg_pixel == 0) || priority){//background is transparent so draw the fg_pixel or sprite has priority
-                final_pixel = fg_pixel;
-                final_palette = fg_palette;
-                if(is_sprite_0_rendering) //we just drown sprite 0
-                    this->registers.PPUSTATUS |= 0x40; //set sprite 0 hit flag.
-            }
-            else {
-                final_pixel = bg_pixel;
-                final_palette = bg_palette;
-            }
-        }
-        else{//forground pixel is transparent
-            //if bg_pixel if transparent, bg color will be drown
-            //else bg_pixel will be drown
-            //in any case,
-            final_pixel = bg_pixel;
-            final_palette = bg_palette;
-        }
-        
-        //43210
-        //|||||
-        //|||++- Pixel value from tile data
-        //|++--- Palette number from attribute table or OAM
-        //+----- Background/Sprite select
-        GRAPHICS::Color c = this->palette->at(this->read( 0x3F00 + ( final_pixel | (final_palette << 2) )) & 0x3F);
-        graphics->DrawPixel(cycle, scanline, c);
+        //the priority between the background and the sprites is decided by the compositor (see compositor.hpp)
+        int x = this->cycle - 1;
+        if(x == 0)
+            this->composited_pixels = 0;
+        (*this->line_background)[x] = bg_pixel | (bg_palette << 2);
+        (*this->line_sprites)[x] = fg_pixel == 0x00 ? 0x00 : (fg_pixel | (fg_palette << 2) | (behind << 4) | (is_sprite_0 << 5));
+        this->staged_pixels = x + 1;
+        if(x == 255)
+            composite();
     }
 
+    dots++;
     cycle++;                                   //each cycle the ppu generate one pixel
+    //rendering disabled: nothing is loaded for the next frame, what is left of the last line rendered (which is not the same
+    //without video) is cleared so that a frame where rendering is enabled again starts the same way (see save_state)
+    if(this->scanline == -1 && this->cycle == 258 && (this->registers.PPUMASK & 0x18) == 0)
+        clear_pipeline();
     if(this->cycle == 361){
         this->cycle = 0;
 
@@ -968,20 +1015,11 @@ void PPU::clock(){
             this->odd_frame = !this->odd_frame;
             if(this->odd_frame)
                 this->cycle = 1;               //first cycle is skiped on odd frames
-            
-            
-            
-            //the following code is meant to write the current frame per seconds as the title
-            frames_last_seconde++;
-            int currentTime = SDL_GetTicks();
-            if (currentTime > last_time + 1000) {
-                std::string re = "FPS: " + std::to_string(frames_last_seconde);
-                graphics->ChangeTitle(re.c_str());
-                last_time = currentTime;
-                frames_last_seconde = 0;
-            }
-            
-            graphics->update(); //update the screen with the new frame
+
+            if(this->timing_only) //the frame is rendered by the deferred renderer from the accesses of the cpu
+                this->log = deferred->submit(this->log, this->dots);
+            else if(this->video && presenter != NULL)
+                this->frame = presenter->publish(); //the presenter thread shows the frame, we render the next one in an other buffer
         }
     }
 
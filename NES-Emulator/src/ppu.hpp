@@ -10,8 +10,12 @@
 
 #include <iostream>
 #include <array>
+#include <vector>
+#include <cstdint>
 
 #include "screen.hpp"
+#include "presenter.hpp"
+#include "compositor.hpp"
 
 
 typedef uint8_t Byte;
@@ -20,6 +24,15 @@ typedef std::array<Byte, 4> Sprite; //each byte as its own role and must be acce
 
 //forward declaration to avoid circular inclusion
 class NES;
+class DEFERRED;
+
+//an access of the cpu to the PPU, recorded for the deferred rendering (see deferred.hpp)
+struct PPU_ACCESS{
+    uint64_t dot; //number of dots the PPU had done when the access happened
+    Address address;
+    Byte value;
+    enum Kind : Byte { WRITE, READ, OAM_DMA, DMA_PAGE } kind;
+};
 
 
 
@@ -35,10 +48,19 @@ private:
     /*
      Graphics
     */
-    GRAPHICS *graphics;;
-    SDL_Event event;
-    int frames_last_seconde = 0; //used to handle fps counter
-    int last_time = 0;
+    PRESENTER *presenter;
+    
+    //deferred rendering (see deferred.hpp)
+    //in timing only mode the PPU keeps its timing, flags and sprite 0 hit but does not render the frame
+    //and the accesses of the cpu are recorded for the deferred renderer
+    bool timing_only = false;
+    DEFERRED *deferred = NULL;
+    std::vector<PPU_ACCESS> *log = NULL;
+    uint64_t dots = 0; //number of dots since power-up
+
+    //without video the frames are not rendered nor published (run-ahead), only sprite 0 hit is computed as in timing only mode
+    bool video = true;
+    bool renders(){ return !this->timing_only && this->video; }
     
     //https://wiki.nesdev.org/w/index.php?title=PPU_frame_timing
     bool odd_frame = false;
@@ -67,19 +89,23 @@ private:
         Byte OAMDMA    = 0x00; // Address 0x4014        OAM DMA register (high byte)
     } registers;
     
-    struct Color{
-        uint8_t r = 0;
-        uint8_t g = 0;
-        uint8_t b = 0;
-        uint8_t o = 255; //opacity
-    };
-    
-    //Memory
+    //Memory (cleared at power-up so that every run is the same, see MOVIE)
     //https://wiki.nesdev.org/w/index.php?title=PPU_memory_map
-    std::array<std::array<Byte, 0x1000>, 2> *Pattern_table = new std::array<std::array<Byte, 0x1000>, 2>; //pattern table 0 and 1
-    std::array<std::array<Byte, 0x0400>, 4> *Nametable = new std::array<std::array<Byte, 0x0400>, 4>;     //nametables 0 to 3
-    std::array<Byte, 0x0020> *Palette = new std::array<Byte, 0x0020>;                                     //current colors in the used palette
-    std::array<GRAPHICS::Color,64> *palette = new std::array<GRAPHICS::Color,64>; //all available colors
+    std::array<std::array<Byte, 0x1000>, 2> *Pattern_table = new std::array<std::array<Byte, 0x1000>, 2>(); //pattern table 0 and 1
+    std::array<std::array<Byte, 0x0400>, 4> *Nametable = new std::array<std::array<Byte, 0x0400>, 4>();     //nametables 0 to 3
+    std::array<Byte, 0x0020> *Palette = new std::array<Byte, 0x0020>();                                     //current colors in the used palette
+    Frame *frame; //palette indexes of the frame being rendered (see screen.hpp), it belongs to the presenter
+    bool owns_frame; //no presenter: the ppu renders in its own buffer
+    
+    //pixels of the current scanline waiting to be composited (see compositor.hpp)
+    //they are composited at the end of the line, or before anything that changes the result (PPUMASK, palette) or reads it (PPUSTATUS) happens
+    COMPOSITOR compositor;
+    std::array<Byte, 256> *line_background = new std::array<Byte, 256>();
+    std::array<Byte, 256> *line_sprites = new std::array<Byte, 256>();
+    std::array<Byte, 256> *line_addresses = new std::array<Byte, 256>();
+    int staged_pixels = 0;     //number of pixels of the line generated so far
+    int composited_pixels = 0; //number of pixels of the line already written to the frame
+    void composite();
     
     
     //background rendering
@@ -101,12 +127,13 @@ private:
     //Sprites
     //Primary OAM (holds 64 sprites for the frame)
     //Secondary OAM (holds 8 sprites for the current scanline)
-    std::array<Sprite, 64> *OAM = new std::array<Sprite, 64>;
-    std::array<Sprite, 8> *Sec_OAM = new std::array<Sprite, 8>;
+    std::array<Sprite, 64> *OAM = new std::array<Sprite, 64>();
+    std::array<Sprite, 8> *Sec_OAM = new std::array<Sprite, 8>();
     int last_available_slot = 0; //helper variable that indicates were to write in the secondary OAM. 8 indicates that the secondary OAM is full.
-    std::array<std::array<Byte,2>,8> *sprite_shift_registers = new std::array<std::array<Byte,2>,8>; //These contain the pattern table data for up to 8 sprites, to be rendered on the current scanline. Unused sprites are loaded with an all-transparent set of values.
-    std::array<Byte,8> *sprite_latches = new std::array<Byte,8>;  //These contain the attribute bytes for up to 8 sprites.
-    std::array<Byte,8> *sprite_counters = new std::array<Byte,8>; //These contain the X positions for up to 8 sprites.
+    std::array<std::array<Byte,2>,8> *sprite_shift_registers = new std::array<std::array<Byte,2>,8>(); //These contain the pattern table data for up to 8 sprites, to be rendered on the current scanline. Unused sprites are loaded with an all-transparent set of values.
+    std::array<Byte,8> *sprite_latches = new std::array<Byte,8>();  //These contain the attribute bytes for up to 8 sprites.
+    std::array<Byte,8> *sprite_counters = new std::array<Byte,8>(); //These contain the X positions for up to 8 sprites.
+    void clear_pipeline(); //shift registers, latches and sprite units
     
     
     int n = 0;                          //helper variable (index which sprite is currently being evaluated)
@@ -120,7 +147,8 @@ public:
     /*
         Constructor
     */
-    PPU(NES*, float screen_coef);
+    PPU(NES*, PRESENTER*); //a PPU without presenter can not render
+    ~PPU();
     
     /*
      Registers
@@ -147,6 +175,10 @@ public:
     //OAMtransfert utility
     void setOAM_with_addr(Byte, Address);
     
+    //registers as seen from the cpu ($2000 ~ $3FFF, mirrored every 8 bytes)
+    void write_register(Address, Byte);
+    Byte read_register(Address);
+    
     //rendering functions
     void reloadShifters();
     void ntbyte();
@@ -189,15 +221,77 @@ public:
     */
     NES *nes;
     void clock();
-    bool is_sprite_0_there = false;
-    bool is_sprite_0_rendering = false;
+    void set_deferred(DEFERRED *);      //switch to timing only mode, the frames are rendered by the deferred renderer
+    void copy_memory(const PPU &);      //pattern tables, nametables, palette and OAM
+    
+    //save states (see NES::save_state): everything but the links to the rest of the emulator, the frame and the video mode
+    //the state must be zeroed by the caller
+    struct State;
+    void save_state(State &);
+    void load_state(const State &);
+    
+    void set_video(bool video){ this->video = video; } //only change it at the start of a frame
+    bool get_video(){ return video; }
+    COMPOSITOR *get_compositor(){ return &compositor; }
+    uint64_t get_dots(){ return dots; }
+    bool is_frame_start(){ return scanline == -1 && cycle == (odd_frame ? 1 : 0); } //the first dot is skipped on odd frames
+    bool is_sprite_0_there = false;  //sprite 0 has been found during the evaluation of the next scanline
+    bool is_sprite_0_loaded = false; //the first sprite of the current scanline is sprite 0
     
     
     //debug
     int get_scanline(){ return scanline; }
     int get_cycle(){ return cycle; }
     struct registers r() {return registers; }
-    GRAPHICS getgraphics() { return *graphics; }
+};
+
+
+struct PPU::State{
+    uint64_t dots;
+    int32_t scanline;
+    int32_t cycle;
+    bool odd_frame;
+    struct registers registers;
+    std::array<std::array<Byte, 0x1000>, 2> Pattern_table;
+    std::array<std::array<Byte, 0x0400>, 4> Nametable;
+    std::array<Byte, 0x0020> Palette;
+
+    std::array<Byte, 256> line_background;
+    std::array<Byte, 256> line_sprites;
+    std::array<Byte, 256> line_addresses;
+    int32_t staged_pixels;
+    int32_t composited_pixels;
+
+    Address pattern_data_shift_register_1;
+    Address pattern_data_shift_register_2;
+    Address palette_attribute_shift_register_1;
+    Address palette_attribute_shift_register_2;
+    Byte pattern_data_shift_register_1_latch;
+    Byte pattern_data_shift_register_2_latch;
+    Byte next_pattern_data_shift_register_location;
+    bool palette_attribute_shift_register_1_latch;
+    bool palette_attribute_shift_register_2_latch;
+
+    std::array<Sprite, 64> OAM;
+    std::array<Sprite, 8> Sec_OAM;
+    int32_t last_available_slot;
+    std::array<std::array<Byte,2>,8> sprite_shift_registers;
+    std::array<Byte,8> sprite_latches;
+    std::array<Byte,8> sprite_counters;
+    int32_t n;
+    int32_t sprite_cycle;
+    Byte sprite_data_read;
+    bool sprite_search_is_done;
+    int32_t number_of_sprites;
+    bool is_sprite_0_there;
+    bool is_sprite_0_loaded;
+
+    Address vmem_addr;
+    Address addr_t;
+    Byte fine_x_scroll;
+    bool write_toggle;
+    bool asknmi;
+    Byte read_buffer;
 };
 
 
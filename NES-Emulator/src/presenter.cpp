@@ -0,0 +1,72 @@
+//
+//  presenter.cpp
+//  NES-Emulator
+//
+
+#include "presenter.hpp"
+
+
+PRESENTER::PRESENTER(float coef, bool vsync){
+    this->graphics = new GRAPHICS(coef, vsync);
+}
+
+PRESENTER::~PRESENTER(){
+    delete graphics;
+}
+
+
+
+Frame *PRESENTER::publish(){
+    unsigned int sequence = ++published;
+    sequences[back] = sequence; //the exchange makes it visible to the presenter
+    if(latency != NULL)
+        latency->published((*frames)[back], sequence);
+    back = middle.exchange(back | FRESH) & 0x03;
+    wake.notify_one();
+    return &(*frames)[back];
+}
+
+void PRESENTER::wait_taken(std::chrono::steady_clock::time_point deadline){
+    std::unique_lock<std::mutex> lock(mutex);
+    while((middle & FRESH) && std::chrono::steady_clock::now() < deadline) //the presenter does not take the mutex when it notifies
+        taken.wait_for(lock, std::chrono::milliseconds(1));
+}
+
+void PRESENTER::run(){
+    unsigned int presented = 0; //frames taken and shown in the last second
+    unsigned int last_emulated = emulated;
+    Uint32 last_time = SDL_GetTicks();
+
+    while(!input->should_quit()){
+        //the window belongs to this thread so its events must be handled here
+        input->poll();
+
+        //the emulation does not take the mutex when it notifies, a notification can be missed
+        //so we never sleep for long (it also keeps the window responsive)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_for(lock, std::chrono::milliseconds(2), [this]{ return (this->middle & FRESH) != 0; });
+        }
+
+        if(middle & FRESH){
+            front = middle.exchange(front) & 0x03;
+            taken.notify_one();
+            graphics->update((*frames)[front]);
+            presented++;
+            if(latency != NULL)
+                latency->presented(sequences[front]);
+        }
+
+        //the following code is meant to write the current frame per seconds as the title
+        Uint32 current_time = SDL_GetTicks();
+        if(current_time > last_time + 1000){
+            unsigned int now_emulated = emulated;
+            std::string re = input->is_paused() ? "Paused" : "FPS: " + std::to_string(presented)
+                                                             + " (emulated: " + std::to_string(now_emulated - last_emulated) + ")";
+            graphics->ChangeTitle(re.c_str());
+            last_time = current_time;
+            presented = 0;
+            last_emulated = now_emulated;
+        }
+    }
+}
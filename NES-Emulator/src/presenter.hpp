@@ -0,0 +1,71 @@
+//
+//  presenter.hpp
+//  NES-Emulator
+//
+
+#ifndef presenter_hpp
+#define presenter_hpp
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <string>
+
+#include "screen.hpp"
+#include "input.hpp"
+#include "latency.hpp"
+
+
+//Shows the frames on the screen.
+//The emulation runs on its own thread and the presenter runs on the main thread (some systems only
+//allow the main thread to use the window) so that a slow present (vsync, busy compositor) never
+//slows down the emulation.
+//
+//Frames go through a lock-free triple buffer:
+//the emulation renders in the back buffer, publish() swaps it with the middle one,
+//and the presenter swaps the middle one with the front one when it is ready for a new frame.
+//Frames the presenter did not have time to show are simply replaced.
+class PRESENTER{
+private:
+    GRAPHICS *graphics;
+    INPUT *input = NULL;
+    LATENCY *latency = NULL;
+
+    std::array<Frame, 3> *frames = new std::array<Frame, 3>;
+    static const int FRESH = 0x04;  //set in middle when it holds a frame the presenter has not taken yet
+    int back = 0;                   //only used by the emulation thread
+    std::atomic<int> middle{1};     //index of the middle buffer | FRESH
+    int front = 2;                  //only used by the presenter
+    std::array<unsigned int, 3> sequences; //sequence number of the frame in each buffer (1 for the first published frame)
+
+    std::atomic<unsigned int> published{0}; //number of frames published since the start
+    std::atomic<unsigned int> emulated{0};  //number of frames emulated since the start (skipped or not)
+
+    //only used to sleep while no frame is published, the frames never go through the mutex
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable taken; //the presenter took the middle buffer
+
+public:
+    PRESENTER(float coef, bool vsync); //creates the window, must be called from the main thread
+    ~PRESENTER();
+
+    //setup (before run())
+    void load_palette(std::string link){ graphics->load_palette(link); }
+    void set_filter(FILTER *filter){ graphics->set_filter(filter); }
+    void set_input(INPUT *input){ this->input = input; }
+    void set_latency(LATENCY *latency){ this->latency = latency; }
+
+    //emulation thread
+    Frame *get_back(){ return &(*frames)[back]; }
+    Frame *publish(); //the back buffer is a finished frame, returns the new back buffer (which contains an old frame)
+    void count_emulated(){ emulated.fetch_add(1, std::memory_order_relaxed); }
+    void wait_taken(std::chrono::steady_clock::time_point deadline); //waits until the presenter took the last published frame
+
+    //main thread, handles the input and returns once the user quits
+    void run();
+};
+
+#endif /* presenter_hpp */
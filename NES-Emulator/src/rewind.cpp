@@ -0,0 +1,126 @@
+//
+//  rewind.cpp
+//  NES-Emulator
+//
+
+#include <cstring>
+
+#include "rewind.hpp"
+#include "packing.hpp"
+#include "nes.hpp"
+
+
+REWIND::REWIND(size_t budget, int interval){
+    this->interval = interval > 0 ? interval : 1;
+    this->ring.resize(budget);
+    this->last.resize(NES::state_size());
+    this->current.resize(NES::state_size());
+    this->packed.resize(2 * NES::state_size() + 16); //more than the worst case
+}
+
+
+
+size_t REWIND::pack(const Byte *from, const Byte *to, size_t size, Byte *out){
+    size_t written = 0;
+    size_t i = 0;
+    while(i < size){
+        //unchanged bytes, 8 at a time while we can
+        size_t start = i;
+        uint64_t a, b;
+        while(i + 8 <= size){
+            std::memcpy(&a, from + i, 8);
+            std::memcpy(&b, to + i, 8);
+            if(a != b)
+                break;
+            i += 8;
+        }
+        while(i < size && from[i] == to[i])
+            i++;
+        if(i == size) //the unchanged end is not stored
+            break;
+        size_t zeros = i - start;
+
+        //changed bytes, until enough unchanged ones follow
+        size_t first = i;
+        size_t same = 0;
+        while(i < size && same < MIN_ZEROS){
+            same = from[i] == to[i] ? same + 1 : 0;
+            i++;
+        }
+        if(same == MIN_ZEROS)
+            i -= MIN_ZEROS;
+        size_t count = i - first;
+
+        written += write_varint(zeros, out + written);
+        written += write_varint(count, out + written);
+        for(size_t j = first; j < i; j++)
+            out[written++] = from[j] ^ to[j];
+    }
+    return written;
+}
+
+void REWIND::unpack(const Byte *in, size_t size, Byte *state){
+    size_t position = 0;
+    size_t i = 0;
+    while(i < size){
+        uint64_t zeros, count;
+        if(!read_varint(in, size, i, zeros) || !read_varint(in, size, i, count)) //the deltas are written by pack(), this does not happen
+            return;
+        position += (size_t) zeros;
+        for(size_t j = 0; j < count; j++)
+            state[position++] ^= in[i++];
+    }
+}
+
+
+
+void REWIND::store(size_t size){
+    if(size > ring.size()){ //the whole history is older than this delta
+        deltas.clear();
+        head = 0;
+        return;
+    }
+
+    if(head + size > ring.size()){
+        //the oldest deltas are after the head, the ones at the end of the ring are dropped and we start again at the beginning
+        while(!deltas.empty() && deltas.front().offset >= head)
+            deltas.pop_front();
+        head = 0;
+    }
+    while(!deltas.empty() && deltas.front().offset < head + size && deltas.front().offset + deltas.front().size > head)
+        deltas.pop_front();
+
+    std::memcpy(ring.data() + head, packed.data(), size);
+    Delta delta = {head, size};
+    deltas.push_back(delta);
+    head += size;
+}
+
+
+void REWIND::capture(NES *nes){
+    if(!empty && ++frames < interval)
+        return;
+    frames = 0;
+
+    nes->save_state(current.data(), current.size());
+    if(!empty)
+        store(pack(current.data(), last.data(), current.size(), packed.data()));
+    last.swap(current);
+    empty = false;
+}
+
+
+void REWIND::step_back(NES *nes){
+    if(empty)
+        return;
+
+    //if the game went on since the last save state, we go back to it first, then to the older ones
+    if(frames == 0 && !deltas.empty()){
+        const Delta &delta = deltas.back();
+        unpack(ring.data() + delta.offset, delta.size, last.data());
+        head = delta.offset;
+        deltas.pop_back();
+    }
+    frames = 0;
+    nes->load_state(last.data(), last.size());
+}
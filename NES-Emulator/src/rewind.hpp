@@ -0,0 +1,61 @@
+//
+//  rewind.hpp
+//  NES-Emulator
+//
+
+#ifndef rewind_hpp
+#define rewind_hpp
+
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <cstddef>
+
+typedef uint8_t Byte;
+
+class NES;
+
+
+//Keeps the last minutes of the game so that it can be played backwards (while backspace is held).
+//
+//A save state (see NES::save_state) is taken every `interval` frames. Only the last one is kept whole,
+//each older one is stored as the XOR of two consecutive states: going back one step is XORing the last delta
+//into the last state. Between two frames only a few hundred bytes of the RAM, OAM and nametables change,
+//so the deltas are mostly zeros and are stored as runs:
+//  [zeros (varint)][count (varint)][count XORed bytes] ...
+//The deltas are written one after the other in a ring of `budget` bytes, the oldest ones are dropped
+//when it is full.
+//
+//Going back one step per frame at the pace of the emulation rewinds at 60 steps per second.
+class REWIND{
+private:
+    static const size_t MIN_ZEROS = 8; //shorter runs of zeros are cheaper to store in the XORed bytes
+
+    struct Delta{
+        size_t offset; //in the ring
+        size_t size;
+    };
+
+    int interval;
+    int frames = 0;                  //since the last save state
+    std::vector<Byte> ring;
+    size_t head = 0;                 //where the next delta is written
+    std::deque<Delta> deltas;        //oldest first
+    std::vector<Byte> last;          //last save state
+    std::vector<Byte> current;
+    std::vector<Byte> packed;        //delta being stored
+    bool empty = true;               //no save state yet
+
+    static size_t pack(const Byte *from, const Byte *to, size_t size, Byte *out);
+    static void unpack(const Byte *in, size_t size, Byte *state); //XORs the delta into the state
+    void store(size_t size);
+
+public:
+    REWIND(size_t budget, int interval); //budget in bytes
+
+    //called when a frame starts
+    void capture(NES *);    //takes a save state every `interval` frames
+    void step_back(NES *);  //loads the previous save state (the oldest one stays loaded)
+};
+
+#endif /* rewind_hpp */
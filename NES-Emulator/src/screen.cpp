@@ -5,22 +5,55 @@
 //  Created by Alexi Canesse on 09/12/2021.
 //
 
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <cstring>
+
 //I know it's a weird way to include SDL but it's the only way I found to use SDL and CMake together
 #include "SDL.h"
 
 #include "screen.hpp"
+#include "filter.hpp"
+
+
+/*
+ define the palette
+ https://wiki.nesdev.org/w/index.php/PPU_palettes#Palettes
+*/
+static const uint8_t default_palette[64 * 3] = {
+     84, 84, 84,    0, 30,116,    8, 16,144,   48,  0,136,   68,  0,100,   92,  0, 48,   84,  4,  0,   60, 24,  0,
+     32, 42,  0,    8, 58,  0,    0, 64,  0,    0, 60,  0,    0, 50, 60,    0,  0,  0,    0,  0,  0,    0,  0,  0,
+    152,150,152,    8, 76,196,   48, 50,236,   92, 30,228,  136, 20,176,  160, 20,100,  152, 34, 32,  120, 60,  0,
+     84, 90,  0,   40,114,  0,    8,124,  0,    0,118, 40,    0,102,120,    0,  0,  0,    0,  0,  0,    0,  0,  0,
+    236,238,236,   76,154,236,  120,124,236,  176, 98,236,  228, 84,236,  236, 88,180,  236,106,100,  212,136, 32,
+    160,170,  0,  116,196,  0,   76,208, 32,   56,204,108,   56,180,204,   60, 60, 60,    0,  0,  0,    0,  0,  0,
+    236,238,236,  168,204,236,  188,188,236,  212,178,236,  236,174,236,  236,174,212,  236,180,176,  228,196,144,
+    204,210,120,  180,222,120,  168,226,144,  152,226,180,  160,214,228,  160,162,160,    0,  0,  0,    0,  0,  0,
+};
+
 
 /*
  Constructor and destructor
 */
-GRAPHICS::GRAPHICS(float coef){
+GRAPHICS::GRAPHICS(float coef, bool vsync){
+    this->vsync = vsync;
+    this->coef = coef;
+    
     SDL_Init(SDL_INIT_VIDEO);       // Initializing SDL as Video
-    SDL_CreateWindowAndRenderer(coef * 320, coef * 240, 0, &window, &renderer);
+    window = SDL_CreateWindow("NES-Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, coef * 320, coef * 240, 0);
+    renderer = SDL_CreateRenderer(window, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
     SDL_RenderSetScale(renderer, coef * 8/7, coef);
     //https://wiki.nesdev.org/w/index.php?title=Overscan explains why the horizontal coefficient is multiplied by 8/7
+
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 256, 240);
+
+    set_palette(default_palette, 64);
 }
 
 GRAPHICS::~GRAPHICS(){
+    SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -28,16 +61,122 @@ GRAPHICS::~GRAPHICS(){
 
 
 
+//64 colors palettes do not contain the emphasized colors so they are computed
+//https://wiki.nesdev.org/w/index.php?title=Colour_emphasis
+//each emphasis bit darkens the two other channels
+void GRAPHICS::set_palette(const uint8_t *rgb, int size){
+    for(int pixel = 0; pixel < 512; pixel++){
+        const uint8_t *c = rgb + 3 * ((size == 512) ? pixel : (pixel & 0x3F));
+        float r = c[0], g = c[1], b = c[2];
 
-void GRAPHICS::DrawPixel(int x, int y, Color c){
-    SDL_SetRenderDrawColor(renderer, c.r, c.g, c.b, c.o);
-    SDL_RenderDrawPoint(renderer, x + 12, y); //offset beacause the nes add borders to get a 280*240 image from a 256*240 image
+        if(size != 512){
+            int emphasis = pixel >> 6; //bit 0: red, bit 1: green, bit 2: blue
+            if(emphasis & 0x01){ g *= 0.816328f; b *= 0.816328f; }
+            if(emphasis & 0x02){ r *= 0.816328f; b *= 0.816328f; }
+            if(emphasis & 0x04){ r *= 0.816328f; g *= 0.816328f; }
+        }
+
+        this->colors->at(pixel) = 0xFF000000 | ((uint32_t) r << 16) | ((uint32_t) g << 8) | (uint32_t) b;
+    }
 }
 
-void GRAPHICS::update(){
+//.pal files are raw rgb triplets. 512 colors files contain the 8 emphasis variations of the 64 colors
+void GRAPHICS::load_palette(std::string link){
+    std::ifstream file;
+    file.open(link, std::ios::binary);
+    if(file.fail()){
+        std::cout << "Cannot open palette file";
+        std::exit(0);
+    }
+
+    std::vector<uint8_t> content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+
+    if(content.size() != 64 * 3 && content.size() != 512 * 3){
+        std::cout << "The palette file must contain 64 or 512 colors";
+        std::exit(0);
+    }
+
+    set_palette(content.data(), (int) content.size() / 3);
+    texture_is_valid = false; //every line must be converted again
+}
+
+
+
+//the filter does the scaling so the renderer does not have to scale anything
+void GRAPHICS::set_filter(FILTER *filter){
+    this->filter = filter;
+    this->texture_is_valid = false;
+
+    SDL_DestroyTexture(texture);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, filter->get_width(), filter->get_height());
+    SDL_RenderSetScale(renderer, 1, 1);
+}
+
+void GRAPHICS::update(const Frame &frame){
+    //On remote desktops and low-power machines, uploading the texture is what costs the most.
+    //Most of the time only a few scanlines change between two frames (or none at all in menus) so
+    //each line is compared with what has already been uploaded and only the changed ranges are sent.
+    bool changed = false;
+    frames++;
+    int y = 0;
+    while(y < 240){
+        if(texture_is_valid && std::memcmp(&frame[y * 256], &(*uploaded)[y * 256], 256 * sizeof(Pixel)) == 0){
+            y++;
+            continue;
+        }
+
+        //extend the range as long as lines are dirty
+        int first = y;
+        while(y < 240 && (!texture_is_valid || std::memcmp(&frame[y * 256], &(*uploaded)[y * 256], 256 * sizeof(Pixel)) != 0))
+            y++;
+
+        if(filter) //the filter needs the whole frame, we only remember what was sent
+            std::memcpy(&(*uploaded)[first * 256], &frame[first * 256], (y - first) * 256 * sizeof(Pixel));
+        else
+            upload(frame, first, y);
+        changed = true;
+    }
+    texture_is_valid = true;
+
+    SDL_Rect destination = {13, 0, 256, 240}; //offset beacause the nes add borders to get a 280*240 image from a 256*240 image
+    if(filter){
+        //the filtered frame is shown one frame later: the filter runs on other threads while we emulate the next frame
+        if(changed || filter->is_animated())
+            filter->submit(frame, *colors, frames);
+        changed = filter->fetch(filtered);
+        if(changed)
+            SDL_UpdateTexture(texture, NULL, filtered.data(), filter->get_width() * sizeof(uint32_t));
+
+        //the renderer is not scaled anymore, the destination is in window pixels
+        destination.x = (int) (13 * coef * 8 / 7);
+        destination.w = (int) (256 * coef * 8 / 7);
+        destination.h = (int) (240 * coef);
+    }
+
+    if(!changed && !vsync) //nothing to show and nobody waits for the vertical blank
+        return;
+
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, NULL, &destination);
     SDL_RenderPresent(renderer);
 }
 
+//convert and upload scanlines first to last - 1
+void GRAPHICS::upload(const Frame &frame, int first, int last){
+    //this is a simple table lookup and the compiler vectorizes it
+    const uint32_t *colors = this->colors->data();
+    uint32_t *argb = this->argb->data();
+    for(int i = first * 256; i < last * 256; i++)
+        argb[i] = colors[frame[i] & 0x01FF];
+
+    std::memcpy(&(*uploaded)[first * 256], &frame[first * 256], (last - first) * 256 * sizeof(Pixel));
+
+    SDL_Rect lines = {0, first, 256, last - first};
+    SDL_UpdateTexture(texture, &lines, argb + first * 256, 256 * sizeof(uint32_t));
+}
+
 void GRAPHICS::ChangeTitle(const char *s){
     SDL_SetWindowTitle(window, s);
 }
@@ -8,34 +8,62 @@
 #ifndef screen_hpp
 #define screen_hpp
 
+#include <array>
+#include <string>
+#include <vector>
+
 //I know it's a weird way to include SDL but it's the only way I found to use SDL and CMake together
 #include "SDL.h"
 
 
+//The PPU does not output colors but palette indexes
+//8 7654 3210
+//| |||| ||||
+//| ||++-++++- Palette index (0x00 ~ 0x3F)
+//+-++------- Emphasis bits (PPUMASK bits 5, 6 and 7)
+//The output stage converts them to colors with a 512 entries table
+typedef uint16_t Pixel;
+typedef std::array<Pixel, 256 * 240> Frame;
+
+
+class FILTER;
+
 class GRAPHICS{
 private:
     SDL_Renderer *renderer = NULL;      // Pointer to the renderer
     SDL_Window *window = NULL;      // Pointer to the window
-    
+    SDL_Texture *texture = NULL;    // 256*240 streaming texture the frames are uploaded to
+
+    std::array<uint32_t, 512> *colors = new std::array<uint32_t, 512>;      //ARGB color of each possible pixel
+    std::array<uint32_t, 256 * 240> *argb = new std::array<uint32_t, 256 * 240>; //converted frame
+
+    //only the scanlines that changed since the last frame are uploaded to the texture
+    Frame *uploaded = new Frame;  //what the texture currently contains
+    bool texture_is_valid = false; //false until the first upload or when the colors change
+    bool vsync = false;           //when vsync is off, a frame that did not change is not presented at all
+
+    //CPU side post-processing (see filter.hpp). When it is used, the texture has the size of the filtered frames
+    FILTER *filter = NULL;
+    std::vector<uint32_t> filtered;
+    float coef = 1;
+    int frames = 0;
+
+    void set_palette(const uint8_t *rgb, int size); //build the color table from 64 or 512 rgb triplets
+    void upload(const Frame &, int first, int last); //convert and upload a range of scanlines
+
 public:
     /*
      Constructor and destructor
     */
-    GRAPHICS(float coef);
+    GRAPHICS(float coef, bool vsync);
     ~GRAPHICS();
-    
-    
-    struct Color{
-        uint8_t r = 0;
-        uint8_t g = 0;
-        uint8_t b = 0;
-        uint8_t o = 255; //opacity
-    };
-    
-    void update(); //updte screen content
-    
+
+    void load_palette(std::string); //load a .pal file (64 or 512 colors)
+    void set_filter(FILTER *);
+
+    void update(const Frame &); //updte screen content (only the lines that changed)
+
     void ChangeTitle(const char *);
-    void DrawPixel(int x, int y, Color);
 };
 
 #endif /* screen_hpp */
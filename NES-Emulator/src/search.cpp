@@ -0,0 +1,161 @@
+//
+//  search.cpp
+//  NES-Emulator
+//
+
+#include <iostream>
+#include <sstream>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <unordered_set>
+#include <cstdio>
+#include <cctype>
+#include <cstdlib>
+
+#include "search.hpp"
+#include "nes.hpp"
+
+
+bool SEARCH::parse_objective(std::string text, std::vector<Term> &objective){
+    objective.clear();
+    text.erase(std::remove_if(text.begin(), text.end(), ::isspace), text.end());
+    size_t i = 0;
+    while(i < text.size()){
+        Term term = {1, 0};
+        if(text[i] == '+' || text[i] == '-')
+            term.weight = text[i++] == '-' ? -1 : 1;
+        if(i < text.size() && std::isdigit(text[i])){ //weight*
+            size_t end = text.find('*', i);
+            if(end == std::string::npos)
+                return false;
+            term.weight *= std::strtoll(text.substr(i, end - i).c_str(), NULL, 10);
+            i = end + 1;
+        }
+        if(i >= text.size() || text[i] != '$')
+            return false;
+        size_t end = ++i;
+        while(end < text.size() && std::isxdigit(text[end]))
+            end++;
+        if(end == i)
+            return false;
+        unsigned long address = std::strtoul(text.substr(i, end - i).c_str(), NULL, 16);
+        if(address > 0x1FFF) //the RAM and its mirrors
+            return false;
+        term.address = (Address) (address & 0x07FF);
+        objective.push_back(term);
+        i = end;
+    }
+    return !objective.empty();
+}
+
+bool SEARCH::parse_buttons(std::string text, std::vector<Byte> &buttons){
+    buttons.clear();
+    std::istringstream values(text);
+    std::string value;
+    while(std::getline(values, value, ',')){
+        char *end;
+        unsigned long buttons_value = std::strtoul(value.c_str(), &end, 16);
+        if(value.empty() || *end != '\0' || buttons_value > 0xFF)
+            return false;
+        buttons.push_back((Byte) buttons_value);
+    }
+    return !buttons.empty();
+}
+
+
+
+SEARCH::SEARCH(std::string rom, const std::vector<Byte> &start, const std::vector<Term> &objective, int threads)
+: rom(rom), start(start), objective(objective), workers(threads < 1 ? 1 : threads){
+    for(int i = 0; i < workers.size(); i++)
+        nes.push_back(NES::headless(rom));
+}
+
+
+
+int64_t SEARCH::score(NES *instance){
+    int64_t score = 0;
+    for(const Term &term : objective)
+        score += term.weight * instance->ram->at(term.address);
+    return score;
+}
+
+void SEARCH::play(NES *instance, Byte buttons){
+    instance->input->hold(buttons);
+    for(int frame = 0; frame < frames; frame++)
+        instance->run_frame();
+}
+
+
+
+void SEARCH::run(int number_of_steps, int frames, size_t beam, const std::vector<Byte> &buttons){
+    this->frames = frames;
+    size_t state_size = NES::state_size();
+
+    frontier.assign(1, Node());
+    frontier[0].state = start;
+    nes[0]->load_state(start.data(), start.size());
+    frontier[0].score = score(nes[0]);
+    frontier[0].hash = STATEHASH::hash(start.data(), start.size());
+    frontier[0].step = NO_STEP;
+    steps.clear();
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    uint64_t emulated = 0;
+    for(int step = 0; step < number_of_steps; step++){
+        //every state of the frontier with every candidate
+        size_t count = frontier.size() * buttons.size();
+        children.resize(count);
+        std::atomic<size_t> next(0);
+        workers.run([&](int worker, int){
+            NES *instance = nes[worker];
+            for(size_t job = next++; job < count; job = next++){
+                const Node &parent = frontier[job / buttons.size()];
+                Node &child = children[job];
+                instance->load_state(parent.state.data(), parent.state.size());
+                play(instance, buttons[job % buttons.size()]);
+                child.state.resize(state_size);
+                instance->save_state(child.state.data(), child.state.size());
+                child.hash = STATEHASH::hash(child.state.data(), child.state.size());
+                child.score = score(instance);
+            }
+        });
+        emulated += count * frames;
+
+        //the best children, each state once (the order of the jobs breaks the ties: the result does not depend on the threads)
+        std::vector<size_t> order(count);
+        for(size_t i = 0; i < count; i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){ return children[a].score > children[b].score; });
+        std::unordered_set<uint64_t> kept;
+        std::vector<Node> next_frontier;
+        for(size_t i = 0; i < count && next_frontier.size() < beam; i++){
+            Node &child = children[order[i]];
+            if(!kept.insert(child.hash).second)
+                continue;
+            Step input = {frontier[order[i] / buttons.size()].step, buttons[order[i] % buttons.size()]};
+            steps.push_back(input);
+            child.step = steps.size() - 1;
+            next_frontier.push_back(std::move(child));
+        }
+        frontier.swap(next_frontier);
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        std::printf("step %d: best score %lld, %zu states, %.0f frames/s\n", step + 1, (long long) frontier[0].score,
+                    frontier.size(), emulated / seconds);
+    }
+    std::printf("best score %lld after %d frames, state hash %016llx\n", (long long) frontier[0].score,
+                number_of_steps * frames, (unsigned long long) frontier[0].hash);
+}
+
+
+
+bool SEARCH::write_movie(std::string path){
+    if(frontier.empty())
+        return false;
+    std::vector<Byte> input; //buttons of each frame
+    for(size_t step = frontier[0].step; step != NO_STEP; step = steps[step].parent)
+        input.insert(input.end(), frames, steps[step].buttons);
+    std::reverse(input.begin(), input.end());
+    return MOVIE::record_input(path, nes[0], start, input);
+}
@@ -0,0 +1,74 @@
+//
+//  search.hpp
+//  NES-Emulator
+//
+
+#ifndef search_hpp
+#define search_hpp
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "workers.hpp"
+
+typedef uint8_t Byte;
+typedef uint16_t Address;
+
+class NES;
+
+
+//Searches the inputs which bring the game to the best states, without window.
+//
+//The score of a state is a sum of RAM bytes with weights, e.g. "256*$0075+$0076-$00a0" (the objective).
+//At each step, every state of the frontier is loaded and played for `frames` frames with each of the
+//candidate buttons held on controller 1 (see INPUT), the children are scored and the `beam` best ones,
+//each state kept only once, are the next frontier.
+//The children are emulated by a pool of threads (see WORKERS), each with its own NES which only loads,
+//plays and saves states (no video, no SDL call).
+//
+//The best input found can be written as a movie (see MOVIE) which plays it from the start state.
+class SEARCH{
+public:
+    struct Term{
+        int64_t weight;
+        Address address; //in the RAM
+    };
+    static bool parse_objective(std::string text, std::vector<Term> &); //false if it is not an objective
+    static bool parse_buttons(std::string text, std::vector<Byte> &);   //hexadecimal values separated by commas
+
+    SEARCH(std::string rom, const std::vector<Byte> &start, const std::vector<Term> &objective, int threads);
+
+    void run(int steps, int frames, size_t beam, const std::vector<Byte> &buttons);
+    bool write_movie(std::string path); //the input of the best state
+
+private:
+    struct Node{
+        std::vector<Byte> state;
+        int64_t score;
+        uint64_t hash;  //of the state, to keep it once
+        size_t step;    //last step of its input in `steps`
+    };
+    struct Step{
+        size_t parent;  //previous step of the input, NO_STEP for the first one
+        Byte buttons;   //held during the frames of the step
+    };
+    static const size_t NO_STEP = (size_t) -1;
+
+    std::string rom;
+    std::vector<Byte> start;
+    std::vector<Term> objective;
+    int frames = 0;              //per step
+
+    WORKERS workers;
+    std::vector<NES *> nes;      //one per thread
+    std::vector<Node> frontier;
+    std::vector<Node> children;
+    std::vector<Step> steps;     //the input of every state in the frontier, as a tree
+
+    int64_t score(NES *);
+    void play(NES *, Byte buttons); //the frames of a step
+};
+
+#endif /* search_hpp */
@@ -0,0 +1,148 @@
+//
+//  session.cpp
+//  NES-Emulator
+//
+
+#include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "session.hpp"
+#include "nes.hpp"
+
+
+SESSION::SESSION(std::string path, std::chrono::seconds interval){
+    this->interval = interval;
+    this->last_save = std::chrono::steady_clock::now();
+    this->state.resize(NES::state_size());
+    this->slot_size = sizeof(Slot) + NES::state_size();
+    this->map_size = 2 * slot_size;
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0 || ftruncate(fd, map_size) != 0){ //a new or smaller file is zero filled: no valid slot
+        std::cout << "Could not open the session file " << path << ", the session will not be saved" << std::endl;
+        return;
+    }
+    void *address = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(address == MAP_FAILED){
+        std::cout << "Could not map the session file " << path << ", the session will not be saved" << std::endl;
+        return;
+    }
+    map = static_cast<Byte *>(address);
+}
+
+SESSION::~SESSION(){
+    if(writer.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_one();
+        writer.join();
+    }
+    if(map != NULL)
+        munmap(map, map_size);
+    if(fd >= 0)
+        ::close(fd);
+}
+
+
+
+uint64_t SESSION::checksum(const Byte *data, size_t size){
+    uint64_t h = 0xcbf29ce484222325;
+    for(size_t i = 0; i < size; i++)
+        h = (h ^ data[i]) * 0x100000001b3;
+    return h;
+}
+
+SESSION::Slot *SESSION::slot(int i){
+    return reinterpret_cast<Slot *>(map + i * slot_size);
+}
+
+
+
+bool SESSION::resume(NES *nes){
+    if(map == NULL)
+        return false;
+
+    //newest valid slot first
+    int order[2] = {0, 1};
+    if(slot(1)->sequence > slot(0)->sequence){
+        order[0] = 1;
+        order[1] = 0;
+    }
+    for(int i : order){
+        Slot *s = slot(i);
+        const Byte *data = reinterpret_cast<const Byte *>(s + 1);
+        if(s->sequence != 0 && s->checksum == checksum(data, NES::state_size()) && nes->load_state(data, NES::state_size())){
+            sequence = s->sequence;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void SESSION::write(){
+    Slot *s = slot(sequence & 1); //the slot which was not written last
+    s->sequence = 0; //invalid until the whole state is there
+    std::memcpy(s + 1, state.data(), state.size());
+    s->checksum = checksum(state.data(), state.size());
+    s->sequence = ++sequence;
+    msync(map, map_size, MS_SYNC);
+}
+
+
+void SESSION::writer_loop(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(1){
+        wake.wait(lock, [this]{ return stop || pending.load(std::memory_order_acquire); });
+        if(stop)
+            return;
+        lock.unlock();
+        write();
+        pending.store(false, std::memory_order_release);
+        lock.lock();
+    }
+}
+
+void SESSION::start(){
+    if(map != NULL)
+        writer = std::thread(&SESSION::writer_loop, this);
+}
+
+
+
+void SESSION::frame(NES *nes){
+    if(map == NULL || pending.load(std::memory_order_acquire))
+        return;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(now - last_save < interval)
+        return;
+    last_save = now;
+
+    nes->save_state(state.data(), state.size());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.store(true, std::memory_order_release);
+    }
+    wake.notify_one();
+}
+
+
+void SESSION::close(NES *nes){
+    if(map == NULL)
+        return;
+    if(writer.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_one();
+        writer.join(); //a state being written is finished first
+    }
+    nes->save_state(state.data(), state.size());
+    write();
+}
@@ -0,0 +1,73 @@
+//
+//  session.hpp
+//  NES-Emulator
+//
+
+#ifndef session_hpp
+#define session_hpp
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+typedef uint8_t Byte;
+
+class NES;
+
+
+//Saves the session in a file mapped in memory so that the emulator resumes where it was when it is started
+//again with the same game, instead of booting it (the file is named after CARTRIDGE::hash).
+//
+//The emulation hands a save state (see NES::save_state) to a background thread every `interval` and the thread
+//copies it into the file and flushes it. The emulation only makes the copy: it never waits for the disk, and if
+//the thread is still writing the previous state the save is done at the next frame.
+//The last state is written when the emulator quits.
+//
+//The file has two slots written in turn, each with a sequence number and a checksum: a power cut while a slot
+//is written leaves the other one, the newest valid slot is loaded.
+class SESSION{
+private:
+    struct Slot{
+        uint64_t sequence; //0: never written
+        uint64_t checksum; //FNV-1a of the state
+    };
+
+    int fd = -1;
+    Byte *map = NULL;
+    size_t map_size = 0;
+    size_t slot_size = 0;
+    uint64_t sequence = 0; //of the last slot written
+
+    std::chrono::steady_clock::duration interval;
+    std::chrono::steady_clock::time_point last_save;
+
+    std::vector<Byte> state;   //copy handed to the writer
+    std::atomic<bool> pending{false};
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread writer;
+
+    static uint64_t checksum(const Byte *, size_t);
+    Slot *slot(int);
+    void write(); //writes state into the oldest slot and flushes it
+    void writer_loop();
+
+public:
+    SESSION(std::string path, std::chrono::seconds interval); //an empty file is created if there is none
+    ~SESSION();
+
+    bool resume(NES *); //loads the newest valid state, false if there is none (the game must be reset)
+    void start();       //starts the writer
+
+    void frame(NES *);  //emulation: a frame starts, hands a state to the writer once per interval
+    void close(NES *);  //when the emulation is over: writes the last state and stops the writer
+};
+
+#endif /* session_hpp */
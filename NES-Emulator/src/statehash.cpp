@@ -0,0 +1,152 @@
+//
+//  statehash.cpp
+//  NES-Emulator
+//
+
+#include <cstring>
+#include <iomanip>
+
+#include "statehash.hpp"
+#include "nes.hpp"
+
+//every x86-64 cpu has SSE2. AVX2 is only used if the cpu running the emulator has it
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define STATEHASH_AVX2
+#endif
+
+
+STATEHASH::STATEHASH(std::string path) : file(path){
+    this->state.resize(NES::state_size());
+}
+
+
+STATEHASH::Kernel STATEHASH::best(const char **name){
+    Kernel kernel = &STATEHASH::scalar;
+    *name = "scalar";
+#if defined(__SSE2__)
+    kernel = &STATEHASH::sse2;
+    *name = "sse2";
+#endif
+#if defined(STATEHASH_AVX2)
+    if(__builtin_cpu_supports("avx2")){
+        kernel = &STATEHASH::avx2;
+        *name = "avx2";
+    }
+#endif
+    return kernel;
+}
+
+const char *STATEHASH::get_name(){
+    const char *name;
+    best(&name);
+    return name;
+}
+
+
+
+void STATEHASH::scalar(const Byte *data, size_t blocks, uint64_t lanes[4], uint64_t keys[4]){
+    for(size_t b = 0; b < blocks; b++)
+        for(int i = 0; i < 4; i++){
+            uint64_t word;
+            std::memcpy(&word, data + 32 * b + 8 * i, 8);
+            uint64_t keyed = word ^ keys[i];
+            lanes[i] += word + (keyed & 0xFFFFFFFF) * (keyed >> 32);
+            keys[i] += STEP;
+        }
+}
+
+
+#if defined(__SSE2__)
+void STATEHASH::sse2(const Byte *data, size_t blocks, uint64_t lanes[4], uint64_t keys[4]){
+    __m128i lanes_01 = _mm_loadu_si128((const __m128i *) lanes);
+    __m128i lanes_23 = _mm_loadu_si128((const __m128i *) (lanes + 2));
+    __m128i keys_01 = _mm_loadu_si128((const __m128i *) keys);
+    __m128i keys_23 = _mm_loadu_si128((const __m128i *) (keys + 2));
+    const __m128i step = _mm_set1_epi64x((long long) STEP);
+
+    for(size_t b = 0; b < blocks; b++){
+        __m128i word_01 = _mm_loadu_si128((const __m128i *) (data + 32 * b));
+        __m128i word_23 = _mm_loadu_si128((const __m128i *) (data + 32 * b + 16));
+        __m128i keyed_01 = _mm_xor_si128(word_01, keys_01);
+        __m128i keyed_23 = _mm_xor_si128(word_23, keys_23);
+        //_mm_mul_epu32 multiplies the low 32 bits of each 64 bit lane
+        lanes_01 = _mm_add_epi64(lanes_01, _mm_add_epi64(word_01, _mm_mul_epu32(keyed_01, _mm_srli_epi64(keyed_01, 32))));
+        lanes_23 = _mm_add_epi64(lanes_23, _mm_add_epi64(word_23, _mm_mul_epu32(keyed_23, _mm_srli_epi64(keyed_23, 32))));
+        keys_01 = _mm_add_epi64(keys_01, step);
+        keys_23 = _mm_add_epi64(keys_23, step);
+    }
+
+    _mm_storeu_si128((__m128i *) lanes, lanes_01);
+    _mm_storeu_si128((__m128i *) (lanes + 2), lanes_23);
+    _mm_storeu_si128((__m128i *) keys, keys_01);
+    _mm_storeu_si128((__m128i *) (keys + 2), keys_23);
+}
+#else
+void STATEHASH::sse2(const Byte *data, size_t blocks, uint64_t lanes[4], uint64_t keys[4]){
+    scalar(data, blocks, lanes, keys);
+}
+#endif
+
+
+#if defined(STATEHASH_AVX2)
+__attribute__((target("avx2")))
+void STATEHASH::avx2(const Byte *data, size_t blocks, uint64_t lanes[4], uint64_t keys[4]){
+    __m256i lanes_0123 = _mm256_loadu_si256((const __m256i *) lanes);
+    __m256i keys_0123 = _mm256_loadu_si256((const __m256i *) keys);
+    const __m256i step = _mm256_set1_epi64x((long long) STEP);
+
+    for(size_t b = 0; b < blocks; b++){
+        __m256i word = _mm256_loadu_si256((const __m256i *) (data + 32 * b));
+        __m256i keyed = _mm256_xor_si256(word, keys_0123);
+        lanes_0123 = _mm256_add_epi64(lanes_0123, _mm256_add_epi64(word, _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32))));
+        keys_0123 = _mm256_add_epi64(keys_0123, step);
+    }
+
+    _mm256_storeu_si256((__m256i *) lanes, lanes_0123);
+    _mm256_storeu_si256((__m256i *) keys, keys_0123);
+}
+#else
+void STATEHASH::avx2(const Byte *data, size_t blocks, uint64_t lanes[4], uint64_t keys[4]){
+    sse2(data, blocks, lanes, keys);
+}
+#endif
+
+
+
+static uint64_t mix(uint64_t h){ //splitmix64 finalizer
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+    return h ^ (h >> 31);
+}
+
+uint64_t STATEHASH::hash(const Byte *data, size_t size){
+    static const char *name;
+    static const Kernel kernel = best(&name);
+
+    uint64_t lanes[4] = {0x243f6a8885a308d3, 0x13198a2e03707344, 0xa4093822299f31d0, 0x082efa98ec4e6c89};
+    uint64_t keys[4] = {0x452821e638d01377, 0xbe5466cf34e90c6c, 0xc0ac29b7c97c50dd, 0x3f84d5b5b5470917};
+    size_t blocks = size / 32;
+    kernel(data, blocks, lanes, keys);
+
+    Byte tail[32] = {}; //the end is padded with zeros
+    std::memcpy(tail, data + 32 * blocks, size - 32 * blocks);
+    scalar(tail, 1, lanes, keys);
+
+    uint64_t h = size;
+    for(int i = 0; i < 4; i++)
+        h = mix(h ^ lanes[i]);
+    return h;
+}
+
+
+void STATEHASH::frame(NES *nes){
+    frames++;
+    if(nes->movie != NULL && nes->movie->get_frame() > frames) //after a seek, the lines still match the ones of a run from the start
+        frames = nes->movie->get_frame();
+    nes->save_state(state.data(), state.size());
+    file << frames << " " << std::hex << std::setw(16) << std::setfill('0') << hash(state.data(), state.size()) << std::dec << "\n";
+}
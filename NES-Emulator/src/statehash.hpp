@@ -0,0 +1,55 @@
+//
+//  statehash.hpp
+//  NES-Emulator
+//
+
+#ifndef statehash_hpp
+#define statehash_hpp
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+
+typedef uint8_t Byte;
+
+class NES;
+
+
+//64 bit hash of the whole state of the machine (the save state, see NES::save_state) at each frame boundary,
+//written to a stream: "frame hash" on each line, frame being the number of frames emulated (of the movie if there is one). Two runs of the same game with the same input (see MOVIE)
+//give the same stream on every build and every machine, the first line where two streams differ is the first
+//frame where the emulation diverged.
+//
+//The hash reads 32 bytes at a time in 4 lanes of 64 bits:
+//  lane += word + low32(word ^ key) * high32(word ^ key), key += STEP
+//then the lanes are mixed together. The SSE2 (2 lanes per register) and AVX2 (4 lanes) versions compute
+//exactly the same thing as the scalar one, the best version the cpu supports is chosen at runtime.
+//Hashing a state takes about a microsecond.
+class STATEHASH{
+public:
+    typedef void (*Kernel)(const Byte *data, size_t blocks, uint64_t lanes[4], uint64_t keys[4]);
+
+    STATEHASH(std::string path);
+
+    static uint64_t hash(const Byte *, size_t);
+    void frame(NES *); //a frame starts: writes the hash of the state
+    bool is_open(){ return (bool) file; }
+
+    static const char *get_name();
+    static void scalar(const Byte *data, size_t blocks, uint64_t lanes[4], uint64_t keys[4]);
+    static void sse2(const Byte *data, size_t blocks, uint64_t lanes[4], uint64_t keys[4]);
+    static void avx2(const Byte *data, size_t blocks, uint64_t lanes[4], uint64_t keys[4]);
+
+private:
+    static const uint64_t STEP = 0x9e3779b97f4a7c15;
+
+    std::ofstream file;
+    std::vector<Byte> state;
+    uint64_t frames = 0; //of the last line
+
+    static Kernel best(const char **name);
+};
+
+#endif /* statehash_hpp */
@@ -0,0 +1,183 @@
+//
+//  statestore.cpp
+//  NES-Emulator
+//
+
+#include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "statestore.hpp"
+#include "packing.hpp"
+#include "nes.hpp"
+
+
+STATESTORE::STATESTORE(std::string directory){
+    this->layout = NES::state_pages();
+    this->record_size = (layout.size() - 1) * sizeof(uint64_t);
+    this->state.resize(NES::state_size());
+
+    mkdir(directory.c_str(), 0755); //it may already exist
+    pages_fd = open((directory + "/pages").c_str(), O_RDWR | O_CREAT, 0644);
+    states_fd = open((directory + "/states").c_str(), O_RDWR | O_CREAT, 0644);
+    if(!is_open()){
+        std::cout << "Could not open the state library " << directory << std::endl;
+        return;
+    }
+
+    flock(pages_fd, LOCK_EX);
+    Header header = {MAGIC, (uint32_t) (layout.size() - 1), NES::state_size()};
+    Header found = {};
+    struct stat states;
+    fstat(states_fd, &states);
+    bool ok;
+    if(states.st_size == 0)
+        ok = pwrite(states_fd, &header, sizeof(Header), 0) == (ssize_t) sizeof(Header);
+    else
+        ok = pread(states_fd, &found, sizeof(Header), 0) == (ssize_t) sizeof(Header)
+             && found.magic == header.magic && found.pages == header.pages && found.state_size == header.state_size;
+    if(ok)
+        refresh();
+    flock(pages_fd, LOCK_UN);
+
+    if(!ok){ //written by an other version
+        std::cout << "The state library " << directory << " was made by an other version of the emulator" << std::endl;
+        close(pages_fd);
+        close(states_fd);
+        pages_fd = states_fd = -1;
+    }
+}
+
+STATESTORE::~STATESTORE(){
+    if(pages_fd >= 0)
+        close(pages_fd);
+    if(states_fd >= 0)
+        close(states_fd);
+}
+
+
+
+void STATESTORE::hash(const Byte *data, size_t size, uint64_t out[2]){
+    uint64_t h0 = 0xcbf29ce484222325; //FNV-1a
+    uint64_t h1 = size;
+    for(size_t i = 0; i < size; i++){
+        h0 = (h0 ^ data[i]) * 0x100000001b3;
+        h1 = (h1 + data[i] + 1) * 0x9e3779b97f4a7c15;
+        h1 ^= h1 >> 29;
+    }
+    out[0] = h0;
+    out[1] = h1;
+}
+
+
+void STATESTORE::refresh(){
+    struct stat pages;
+    fstat(pages_fd, &pages);
+    PageHeader header;
+    while(pages_end + sizeof(PageHeader) <= (uint64_t) pages.st_size){
+        if(pread(pages_fd, &header, sizeof(PageHeader), pages_end) != (ssize_t) sizeof(PageHeader)
+           || pages_end + sizeof(PageHeader) + header.packed > (uint64_t) pages.st_size)
+            break; //cut by a crash, the next page overwrites it
+        Known page = {header.hash[1], pages_end};
+        known.insert(std::make_pair(header.hash[0], page));
+        pages_end += sizeof(PageHeader) + header.packed;
+    }
+}
+
+
+int64_t STATESTORE::save(NES *nes){
+    if(!is_open())
+        return -1;
+    nes->save_state(state.data(), state.size());
+
+    size_t pages = layout.size() - 1;
+    std::vector<uint64_t> record(pages);
+    std::vector<uint64_t> hashes(2 * pages);
+    for(size_t p = 0; p < pages; p++)
+        hash(state.data() + layout[p], layout[p + 1] - layout[p], &hashes[2 * p]);
+
+    flock(pages_fd, LOCK_EX);
+    refresh();
+
+    //the new pages are written together
+    buffer.clear();
+    for(size_t p = 0; p < pages; p++){
+        std::unordered_map<uint64_t, Known>::iterator page = known.find(hashes[2 * p]);
+        if(page != known.end() && page->second.hash == hashes[2 * p + 1]){
+            record[p] = page->second.offset;
+            continue;
+        }
+
+        size_t size = layout[p + 1] - layout[p];
+        size_t start = buffer.size();
+        buffer.resize(start + sizeof(PageHeader) + 2 * size + 10);
+        size_t packed = pack_runs(state.data() + layout[p], size, buffer.data() + start + sizeof(PageHeader));
+        if(packed >= size){
+            std::memcpy(buffer.data() + start + sizeof(PageHeader), state.data() + layout[p], size);
+            packed = size;
+        }
+        PageHeader header = {{hashes[2 * p], hashes[2 * p + 1]}, (uint32_t) size, (uint32_t) packed};
+        std::memcpy(buffer.data() + start, &header, sizeof(PageHeader));
+        buffer.resize(start + sizeof(PageHeader) + packed);
+
+        record[p] = pages_end + start;
+        Known known_page = {hashes[2 * p + 1], record[p]};
+        known[hashes[2 * p]] = known_page;
+    }
+
+    bool ok = buffer.empty() || pwrite(pages_fd, buffer.data(), buffer.size(), pages_end) == (ssize_t) buffer.size();
+    int64_t id = -1;
+    if(ok){
+        pages_end += buffer.size();
+        struct stat states;
+        fstat(states_fd, &states);
+        id = (states.st_size - sizeof(Header)) / record_size; //a record cut by a crash is overwritten
+        if(pwrite(states_fd, record.data(), record_size, sizeof(Header) + id * record_size) != (ssize_t) record_size)
+            id = -1;
+    }
+    else{ //the index would point to pages which are not there
+        known.clear();
+        pages_end = 0;
+        refresh();
+    }
+    flock(pages_fd, LOCK_UN);
+    return id;
+}
+
+
+bool STATESTORE::load(NES *nes, uint64_t id){
+    if(!is_open() || id >= count())
+        return false;
+
+    size_t pages = layout.size() - 1;
+    std::vector<uint64_t> record(pages);
+    if(pread(states_fd, record.data(), record_size, sizeof(Header) + id * record_size) != (ssize_t) record_size)
+        return false;
+
+    for(size_t p = 0; p < pages; p++){
+        size_t size = layout[p + 1] - layout[p];
+        buffer.resize(sizeof(PageHeader) + size);
+        ssize_t read = pread(pages_fd, buffer.data(), buffer.size(), record[p]); //the page may be smaller
+        PageHeader header;
+        std::memcpy(&header, buffer.data(), sizeof(PageHeader));
+        if(read < (ssize_t) sizeof(PageHeader) || header.size != size || read < (ssize_t) (sizeof(PageHeader) + header.packed))
+            return false;
+
+        if(header.packed == size)
+            std::memcpy(state.data() + layout[p], buffer.data() + sizeof(PageHeader), size);
+        else if(!unpack_runs(buffer.data() + sizeof(PageHeader), header.packed, state.data() + layout[p], size))
+            return false; //the page is corrupt
+    }
+    return nes->load_state(state.data(), state.size());
+}
+
+
+uint64_t STATESTORE::count(){
+    struct stat states;
+    if(!is_open() || fstat(states_fd, &states) != 0 || states.st_size < (off_t) sizeof(Header))
+        return 0;
+    return (states.st_size - sizeof(Header)) / record_size;
+}
@@ -0,0 +1,74 @@
+//
+//  statestore.hpp
+//  NES-Emulator
+//
+
+#ifndef statestore_hpp
+#define statestore_hpp
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+typedef uint8_t Byte;
+
+class NES;
+
+
+//On-disk library of save states, for tools which keep millions of them.
+//
+//Each state is split into pages (see NES::state_pages: the RAM, each nametable, the palette, the OAM, the
+//pattern tables and the registers between them). A page is stored once in `pages` and found by its hash,
+//a state is a record of page offsets in `states` and its id is the index of that record.
+//Most pages are shared by many states: the pattern tables are the CHR of the cartridge, so they are stored
+//once for the whole library, and the PRG ROM is never part of a state.
+//New pages are compressed with runs of repeated bytes (see packing.hpp), or kept as they are if that does not make them smaller.
+//
+//Both files are only appended to. Several processes can add states to the same library: the appends are done
+//under an exclusive lock (flock) on `pages`, after reading the pages the others added since the last save.
+//Loading a state takes one read per page, without any lock.
+class STATESTORE{
+private:
+    static const uint32_t MAGIC = 0x5453454e; //"NEST"
+
+    struct Header{          //start of `states`
+        uint32_t magic;
+        uint32_t pages;     //per state
+        uint64_t state_size;
+    };
+    struct PageHeader{      //before each page in `pages`
+        uint64_t hash[2];   //two independent 64 bit hashes of the content
+        uint32_t size;
+        uint32_t packed;    //size in the file
+    };
+    struct Known{
+        uint64_t hash;      //second hash
+        uint64_t offset;
+    };
+
+    int pages_fd = -1;
+    int states_fd = -1;
+    std::vector<size_t> layout;         //see NES::state_pages
+    size_t record_size = 0;             //of a state in `states`
+    std::unordered_map<uint64_t, Known> known; //pages in the file, by their first hash
+    uint64_t pages_end = 0;             //the index is up to date until there
+
+    std::vector<Byte> state;
+    std::vector<Byte> buffer;
+
+    static void hash(const Byte *, size_t, uint64_t out[2]);
+    void refresh(); //reads the pages the other processes added
+
+public:
+    STATESTORE(std::string directory); //created if it does not exist
+    ~STATESTORE();
+
+    bool is_open(){ return pages_fd >= 0 && states_fd >= 0; }
+    int64_t save(NES *);            //returns the id of the state, -1 if it could not be written
+    bool load(NES *, uint64_t id);  //false if there is no such state, it is not a state of this game or it is corrupt
+    uint64_t count();               //number of states
+};
+
+#endif /* statestore_hpp */
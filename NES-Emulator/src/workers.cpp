@@ -0,0 +1,59 @@
+//
+//  workers.cpp
+//  NES-Emulator
+//
+
+#include "workers.hpp"
+
+
+WORKERS::WORKERS(int number_of_threads){
+    for(int i = 1; i < number_of_threads; i++) //strip 0 is done by the thread calling run()
+        threads.push_back(std::thread(&WORKERS::loop, this, i));
+}
+
+WORKERS::~WORKERS(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for(size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+}
+
+
+void WORKERS::run(std::function<void(int, int)> job){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->job = job;
+        this->remaining = (int) threads.size();
+        this->generation++;
+    }
+    wake.notify_all();
+
+    job(0, size());
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]{ return this->remaining == 0; });
+}
+
+void WORKERS::loop(int strip){
+    int seen = 0;
+    while(1){
+        std::function<void(int, int)> current;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this, seen]{ return this->stop || this->generation != seen; });
+            if(stop)
+                return;
+            seen = generation;
+            current = job;
+        }
+
+        current(strip, size());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if(--remaining == 0)
+            done.notify_one();
+    }
+}
@@ -0,0 +1,44 @@
+//
+//  workers.hpp
+//  NES-Emulator
+//
+
+#ifndef workers_hpp
+#define workers_hpp
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+
+//A small pool of threads used to split image processing in horizontal strips.
+//run() gives one strip to each thread (the calling thread included) and returns once all of them are done.
+class WORKERS{
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    std::function<void(int, int)> job; //job(strip, number_of_strips)
+    int generation = 0; //incremented each time a new job is given
+    int remaining = 0;  //number of threads that have not finished the current job
+    bool stop = false;
+
+    void loop(int strip);
+
+public:
+    WORKERS(int number_of_threads); //the calling thread counts as one of them
+    ~WORKERS();
+
+    int size(){ return (int) threads.size() + 1; }
+    void run(std::function<void(int, int)> job);
+
+    //first and last (excluded) line of a strip
+    static int first_line(int strip, int strips, int lines){ return lines * strip / strips; }
+    static int last_line(int strip, int strips, int lines){ return lines * (strip + 1) / strips; }
+};
+
+#endif /* workers_hpp */